@@ -25,272 +25,318 @@
 
 #include <limits>
 #include <math.h>
+#include <float.h>
 #include <stdint.h>
+#include <limits.h>
+#include <string.h>
 #include "micro_format.hpp"
 
+#if defined (_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define MF_SCAN_SSE2
+#elif defined (__ARM_NEON)
+#include <arm_neon.h>
+#define MF_SCAN_NEON
+#elif !defined (__BYTE_ORDER__) || (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define MF_SCAN_SWAR
+#endif
+
+// Aligned block may be read after end of string
+#if defined (__clang__)
+#define MF_NO_SANITIZE __attribute__((no_sanitize("address", "thread")))
+#elif defined (__GNUC__)
+#define MF_NO_SANITIZE __attribute__((no_sanitize_address, no_sanitize_thread))
+#else
+#define MF_NO_SANITIZE
+#endif
+
 namespace mf {
 namespace impl {
 
+// FMA is used only if it is hardware instruction. Software fma is slower
+// than Dekker's product on soft-float targets
 #if defined (MICRO_FORMAT_DOUBLE)
 #define MODF modf
+#if defined (FP_FAST_FMA)
+#define FMA fma
+#endif
 #elif defined (MICRO_FORMAT_FLOAT)
 #define MODF modff
+#if defined (FP_FAST_FMAF)
+#define FMA fmaf
+#endif
 #endif
 
-struct FormatSpec
-{
-	struct SpecFlags
-	{
-		uint8_t octothorp : 1;
-		uint8_t upper_case : 1;
-		uint8_t zero : 1;
-		uint8_t parsed_ok : 1;
-	};
-
-	int width = -1;
-	int precision = -1;
-	int length = -1;
-	int index = -1;
-	SpecFlags flags{};
-	char align = 0; // '<', '^', '>'
-	char sign = 0;  // '+', '-', ' '
-	char format = 0;
-};
-
-static bool is_integer_arg_type(FormatArgType arg_type)
-{
-	return
-		(arg_type == FormatArgType::Int) ||
-		(arg_type == FormatArgType::UInt);
-}
-
-static bool is_float_arg_type(FormatArgType arg_type)
-{
-	return
-		(arg_type == FormatArgType::Float);
-}
-
-static bool is_char_arg_type(FormatArgType arg_type)
-{
-	return
-		(arg_type == FormatArgType::Char);
-}
+#if defined (MICRO_FORMAT_INT64) || (ULONG_MAX > 0xFFFFFFFFUL)
+#define UINT_TYPE_IS_64_BIT
+#endif
 
-static bool is_bool_arg_type(FormatArgType arg_type)
+// Destination without callbacks only counts characters
+static bool is_counting_only(const DstData& dst)
 {
-	return
-		(arg_type == FormatArgType::Bool);
+	return !dst.callback && !dst.block_callback;
 }
 
-static bool is_str_arg_type(FormatArgType arg_type)
+static void put_char(DstData& dst, char chr)
 {
-	return
-		(arg_type == FormatArgType::CharPtr);
-}
+	if (dst.block_callback)
+	{
+		if (dst.is_full) return;
+		size_t accepted = dst.block_callback(dst.data, &chr, 1);
+		dst.chars_printed += accepted;
+		dst.is_full = (accepted == 0);
+		return;
+	}
 
+	if (!dst.callback)
+	{
+		++dst.chars_printed;
+		return;
+	}
 
-static void put_char(DstData& dst, char chr)
-{
 	bool char_is_printed = dst.callback(dst.data, chr);
 	if (char_is_printed)
 		++dst.chars_printed;
 }
 
-static void print_raw_string(DstData& dst, const char *text)
+static size_t count_code_points(const char* text, size_t len);
+
+static void put_chars(DstData& dst, const char* text, size_t len)
 {
-	while (*text)
+	if (len == 0) return;
+
+	if (dst.block_callback)
+	{
+		if (dst.is_full) return;
+		size_t accepted = dst.block_callback(dst.data, text, len);
+		dst.chars_printed += accepted;
+		dst.is_full = (accepted < len);
+		return;
+	}
+
+	// text of custom formatter is counted in code points for format_u8
+	if (!dst.callback)
+	{
+		dst.chars_printed += dst.utf8_width ? count_code_points(text, len) : len;
+		return;
+	}
+
+	while (len--)
 		put_char(dst, *text++);
 }
 
-static void print_error(FormatCtx& ctx)
+void put_text(DstData& dst, const char* text, size_t len)
 {
-	print_raw_string(ctx.dst, "{{error}}");
+	put_chars(dst, text, len);
 }
 
-static const char* get_format_specifier(const char* format_str, FormatSpec& format_spec, int index)
+static void put_fill(DstData& dst, char chr, int count)
 {
-	enum class State : uint8_t
-	{
-		Undef,
-		IndexSpecified,
-		PtPassed,
-		PrecSpecified,
-		FormatSpecified,
-		Finished
-	};
+	if (count <= 0) return;
 
-	State state = State::Undef;
-
-	const char* orig_format_str = format_str;
-
-	int* int_value = &format_spec.index;
+	if (is_counting_only(dst))
+	{
+		dst.chars_printed += count;
+		return;
+	}
 
-	for (;;)
+	if (!dst.block_callback)
 	{
-		unsigned char chr = (unsigned char)*format_str++;
+		while (count--)
+			put_char(dst, chr);
+		return;
+	}
 
-		if ((chr >= '0') && (chr <= '9'))
-		{
-			if ((state >= State::IndexSpecified) &&
-				(state < State::PtPassed) &&
-				(chr == '0') &&
-				(*int_value == -1))
-			{
-				format_spec.flags.zero = true;
-				continue;
-			}
-			else if (int_value)
-			{
-				if (*int_value == -1) *int_value = 0;
-				*int_value *= 10;
-				*int_value += chr - '0';
-				continue;
-			}
-			else
-				return orig_format_str;
-		}
-		else if (int_value && (*int_value != -1))
-			int_value = nullptr;
+	char fill[16];
+	for (auto& c : fill) c = chr;
 
-		switch (chr)
-		{
-		case ':':
-			if (state == State::Undef)
-			{
-				int_value = &format_spec.width;
-				state = State::IndexSpecified;
-			}
-			else
-				return orig_format_str;
-			break;
+	while ((count > 0) && !dst.is_full)
+	{
+		int len = (count < (int)sizeof(fill)) ? count : (int)sizeof(fill);
+		put_chars(dst, fill, len);
+		count -= len;
+	}
+}
 
-		case '.':
-			if ((state >= State::IndexSpecified) && (state < State::PtPassed))
-			{
-				int_value = &format_spec.precision;
-				state = State::PtPassed;
-			}
-			else
-				return orig_format_str;
-			break;
+static int find_first_bit(uint64_t value)
+{
+#if defined (__GNUC__) || defined (__clang__)
+	return __builtin_ctzll(value);
+#elif defined (_MSC_VER)
+	unsigned long index = 0;
+	if (_BitScanForward(&index, (uint32_t)value)) return (int)index;
+	_BitScanForward(&index, (uint32_t)(value >> 32));
+	return (int)index + 32;
+#else
+	int result = 0;
+	while (!(value & 1)) { value >>= 1; result++; }
+	return result;
+#endif
+}
 
-		case '<': case '>': case '^':
-			if (format_spec.align == 0)
-				format_spec.align = chr;
-			else
-				return orig_format_str;
-			break;
+#if defined (MF_SCAN_SSE2)
 
-		case '+': case '-': case ' ':
-			if (format_spec.sign == 0)
-				format_spec.sign = chr;
-			else
-				return orig_format_str;
-			break;
-
-		case '#':
-			format_spec.flags.octothorp = true;
-			break;
-
-		case 'B': case 'b': case 'd':
-		case 'o': case 'x': case 'X':
-		case 'c': case 'f': case 'F':
-		case 's':
-			if (format_spec.format == 0)
-				format_spec.format = chr;
-			else
-				return orig_format_str;
-			state = State::FormatSpecified;
-			break;
+// Mask of characters of text block which are zero or '{' (if StopAtBrace is set)
+static const size_t scan_block_size = 16;
+static const int scan_bits_per_char = 1;
 
-		case '}':
-			state = State::Finished;
-			break;
+template <bool StopAtBrace>
+MF_NO_SANITIZE static uint64_t get_stop_mask(const char* block)
+{
+	__m128i chars = _mm_load_si128((const __m128i*)block);
+	__m128i stop = _mm_cmpeq_epi8(chars, _mm_setzero_si128());
+	if (StopAtBrace)
+		stop = _mm_or_si128(stop, _mm_cmpeq_epi8(chars, _mm_set1_epi8('{')));
+	return (unsigned)_mm_movemask_epi8(stop);
+}
 
-		default:
-			return orig_format_str;
-		}
+#elif defined (MF_SCAN_NEON)
 
-		if (state == State::Finished) break;
-	}
+static const size_t scan_block_size = 16;
+static const int scan_bits_per_char = 4;
 
-	auto user_format = format_spec.format;
-	switch (format_spec.format)
-	{
-	case 'F': format_spec.format = 'f'; break;
-	case 'X': format_spec.format = 'x'; break;
-	case 'B': format_spec.format = 'b'; break;
-	}
-	format_spec.flags.upper_case = (user_format != format_spec.format);
+template <bool StopAtBrace>
+MF_NO_SANITIZE static uint64_t get_stop_mask(const char* block)
+{
+	uint8x16_t chars = vld1q_u8((const uint8_t*)block);
+	uint8x16_t stop = vceqq_u8(chars, vdupq_n_u8(0));
+	if (StopAtBrace)
+		stop = vorrq_u8(stop, vceqq_u8(chars, vdupq_n_u8('{')));
+	// 4 bits for each character
+	uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(stop), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
 
-	format_spec.flags.parsed_ok = true;
+#elif defined (MF_SCAN_SWAR)
 
-	if (format_spec.index == -1)
-		format_spec.index = index;
+static const size_t scan_block_size = sizeof(uintptr_t);
+static const int scan_bits_per_char = 8;
 
-	return format_str;
+// 0x80 in each zero byte of word
+static uintptr_t get_zero_bytes(uintptr_t word)
+{
+	const uintptr_t low_bits = (uintptr_t)-1 / 0xFF * 0x7F;
+	return ~(((word & low_bits) + low_bits) | word | low_bits);
 }
 
-static bool check_format_specifier(FormatCtx& ctx, FormatSpec& format_spec)
+template <bool StopAtBrace>
+MF_NO_SANITIZE static uint64_t get_stop_mask(const char* block)
 {
-	if (format_spec.index >= ctx.args_count) return false;
-
-	auto type = ctx.args[format_spec.index].type;
-	auto f = format_spec.format;
+	uintptr_t word;
+	memcpy(&word, block, sizeof(word));
+	uintptr_t stop = get_zero_bytes(word);
+	if (StopAtBrace)
+		stop |= get_zero_bytes(word ^ ((uintptr_t)-1 / 0xFF * '{'));
+	return stop;
+}
 
-	if (is_float_arg_type(type) && (f != 'f') && (f != 0))
-		return false;
+#endif
 
-	bool is_integer_presentation =
-		(f == 'b') || (f == 'd') || (f == 'o') || (f == 'x');
+// Finds first zero character or '{' (if StopAtBrace is set). Text is read
+// by aligned blocks which never cross page boundary so reading of few bytes
+// after end of text is safe
+template <bool StopAtBrace>
+static const char* find_text_end(const char* text)
+{
+#if defined (MF_SCAN_SSE2) || defined (MF_SCAN_NEON) || defined (MF_SCAN_SWAR)
+	const char* block = (const char*)((uintptr_t)text & ~(uintptr_t)(scan_block_size - 1));
+	uint64_t mask = get_stop_mask<StopAtBrace>(block) >> ((text - block) * scan_bits_per_char);
+	if (mask) return text + find_first_bit(mask) / scan_bits_per_char;
 
-	if ((is_integer_arg_type(type) || is_char_arg_type(type)) &&
-	    !is_integer_presentation && (f != 'c') && (f != 0))
-		return false;
+	for (;;)
+	{
+		block += scan_block_size;
+		mask = get_stop_mask<StopAtBrace>(block);
+		if (mask) return block + find_first_bit(mask) / scan_bits_per_char;
+	}
+#else
+	while (*text && (!StopAtBrace || (*text != '{')))
+		text++;
+	return text;
+#endif
+}
 
-	if (is_bool_arg_type(type) && !is_integer_presentation && (f != 's') && (f != 0))
-		return false;
+static int strlen(const char* str)
+{
+	return (int)(find_text_end<false>(str) - str);
+}
 
-	if (is_str_arg_type(type) && (f != 's') && (f != 0))
-		return false;
+static bool is_utf8_continuation(char chr)
+{
+	return ((uint8_t)chr & 0b11000000) == 0b10000000;
+}
 
-	return true;
+static int count_bits(uint64_t value)
+{
+#if defined (__GNUC__) || defined (__clang__)
+	return __builtin_popcountll(value);
+#else
+	int result = 0;
+	for (; value; value &= value - 1) result++;
+	return result;
+#endif
 }
 
-static void correct_format_specifier(FormatCtx& ctx, FormatSpec& format_spec)
+// Number of utf8 code points (bytes which are not continuation of sequence)
+static size_t count_code_points(const char* text, size_t len)
 {
-	auto arg_type = ctx.args[format_spec.index].type;
+	size_t pos = 0;
+	size_t continuations = 0;
 
-	if (format_spec.align == 0)
+#if defined (MF_SCAN_SSE2)
+	// continuation bytes are 0x80..0xBF, i.e. less than -64 as signed
+	const __m128i limit = _mm_set1_epi8(-64);
+	for (; pos + 16 <= len; pos += 16)
 	{
-		if (is_integer_arg_type(arg_type) || is_float_arg_type(arg_type))
-			format_spec.align = '>';
-		else
-			format_spec.align = '<';
+		__m128i chars = _mm_loadu_si128((const __m128i*)(text + pos));
+		continuations += count_bits((unsigned)_mm_movemask_epi8(_mm_cmplt_epi8(chars, limit)));
 	}
-
-	switch (arg_type)
+#elif defined (MF_SCAN_SWAR)
+	const uintptr_t high_bits = (uintptr_t)-1 / 0xFF * 0x80;
+	for (; pos + sizeof(uintptr_t) <= len; pos += sizeof(uintptr_t))
 	{
-	case FormatArgType::Pointer:
-		if (format_spec.format == 0)
-		{
-			format_spec.format = 'p';
-			format_spec.flags.zero = true;
-			format_spec.flags.octothorp = true;
+		uintptr_t word;
+		memcpy(&word, text + pos, sizeof(word));
+		// bit 7 is set and bit 6 is clear
+		continuations += count_bits(word & ~(word << 1) & high_bits);
+	}
+#endif
 
-			if (format_spec.width == -1)
-				format_spec.width = 2 * sizeof(void*) + (format_spec.flags.octothorp ? 2 : 0);
-		}
-		break;
+	for (; pos < len; pos++)
+		if (is_utf8_continuation(text[pos])) continuations++;
 
-	case FormatArgType::Float:
-		if (format_spec.precision == -1)
-			format_spec.precision = 6;
-		break;
+	return len - continuations;
+}
 
-	default:
-		break;
-	}
+static void print_raw_string(DstData& dst, const char *text)
+{
+	put_chars(dst, text, strlen(text));
+}
+
+static const char error_text[] = "{{error}}";
+
+static void print_error(FormatCtx& ctx)
+{
+	print_raw_string(ctx.dst, error_text);
+}
+
+// Argument of width or precision must be integer
+static bool check_dynamic_arg(FormatCtx& ctx, int arg_index)
+{
+	return (arg_index == -1) || ((arg_index < ctx.args_count) && is_integer_arg_type(unpack_arg_type(ctx.arg_types, arg_index)));
+}
+
+static bool check_format_specifier(FormatCtx& ctx, const FormatSpec& format_spec)
+{
+	if (format_spec.index >= ctx.args_count) return false;
+	return
+		check_format_specifier(format_spec, unpack_arg_type(ctx.arg_types, format_spec.index)) &&
+		check_dynamic_arg(ctx, format_spec.width_index) &&
+		check_dynamic_arg(ctx, format_spec.precision_index);
 }
 
 static void print_presentation(FormatCtx& ctx, const FormatSpec& format_spec)
@@ -300,13 +346,11 @@ static void print_presentation(FormatCtx& ctx, const FormatSpec& format_spec)
 	switch (format_spec.format)
 	{
 	case 'x': case 'p':
-		put_char(ctx.dst, '0');
-		put_char(ctx.dst, format_spec.flags.upper_case ? 'X' : 'x');
+		put_chars(ctx.dst, format_spec.flags.upper_case ? "0X" : "0x", 2);
 		break;
 
 	case 'b':
-		put_char(ctx.dst, '0');
-		put_char(ctx.dst, format_spec.flags.upper_case ? 'B' : 'b');
+		put_chars(ctx.dst, format_spec.flags.upper_case ? "0B" : "0b", 2);
 		break;
 
 	case 'o':
@@ -333,17 +377,16 @@ static void print_leading_spaces(FormatCtx& ctx, const FormatSpec& format_spec,
 
 	if (format_spec.flags.zero || (format_spec.align == '>'))
 	{
-		char_to_print = (!ignore_zero_flag && format_spec.flags.zero) ? '0' : ' ';
+		char_to_print = (!ignore_zero_flag && format_spec.flags.zero) ? '0' : format_spec.fill;
 		chars_count = format_spec.width - len;
 	}
 	else if (format_spec.align == '^')
 	{
-		char_to_print = ' ';
+		char_to_print = format_spec.fill;
 		chars_count = (format_spec.width - len) / 2;
 	}
 
-	while (chars_count--)
-		put_char(ctx.dst, char_to_print);
+	put_fill(ctx.dst, char_to_print, chars_count);
 }
 
 static void print_trailing_spaces(FormatCtx& ctx, const FormatSpec& format_spec, int len)
@@ -358,8 +401,13 @@ static void print_trailing_spaces(FormatCtx& ctx, const FormatSpec& format_spec,
 	else if (format_spec.align == '^')
 		chars_count = (format_spec.width - len + 1) / 2;
 
-	while (chars_count--)
-		put_char(ctx.dst, ' ');
+	put_fill(ctx.dst, format_spec.fill, chars_count);
+}
+
+// Counts field of len characters with padding up to width
+static void count_field(FormatCtx& ctx, const FormatSpec& format_spec, int len)
+{
+	ctx.dst.chars_printed += (format_spec.width > len) ? format_spec.width : len;
 }
 
 static void print_sign_and_leading_spaces(FormatCtx& ctx, const FormatSpec& format_spec, bool is_negative, int len, bool ignore_zero_flag)
@@ -379,94 +427,219 @@ static void print_sign_and_leading_spaces(FormatCtx& ctx, const FormatSpec& form
 	}
 }
 
-static int strlen(const char* str)
-{
-	int result = 0;
-	while (*str++) result++;
-	return result;
-}
-
-static void print_string_impl(FormatCtx& ctx, const FormatSpec& format_spec, const char* str, bool is_negative)
+static void print_string_impl(FormatCtx& ctx, const FormatSpec& format_spec, const char* str, int str_len, bool is_negative)
 {
-	int len = strlen(str);
+	int len = ctx.dst.utf8_width ? (int)count_code_points(str, str_len) : str_len;
 	if (is_negative || (format_spec.sign == '+') || (format_spec.sign == ' ')) len++;
+
+	if (is_counting_only(ctx.dst))
+	{
+		count_field(ctx, format_spec, len);
+		return;
+	}
 	print_sign_and_leading_spaces(ctx, format_spec, is_negative, len, true);
-	print_raw_string(ctx.dst, str);
+	put_chars(ctx.dst, str, str_len);
 	print_trailing_spaces(ctx, format_spec, len);
 }
 
 static void print_char_impl(FormatCtx& ctx, const FormatSpec& format_spec, char value)
 {
-	char str[] = { value , 0 };
-	print_string_impl(ctx, format_spec, str, false);
+	print_string_impl(ctx, format_spec, &value, 1, false);
 }
 
-static void print_uint_impl(DstData& dst, UIntType value, unsigned base, bool upper_case)
+static const char dec_digits_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const uint64_t pow10_table[] = {
+	1ULL,
+	10ULL,
+	100ULL,
+	1'000ULL,
+	10'000ULL,
+	100'000ULL,
+	1'000'000ULL,
+	10'000'000ULL,
+	100'000'000ULL,
+	1'000'000'000ULL,
+	10'000'000'000ULL,
+	100'000'000'000ULL,
+	1'000'000'000'000ULL,
+	10'000'000'000'000ULL,
+	100'000'000'000'000ULL,
+	1'000'000'000'000'000ULL,
+	10'000'000'000'000'000ULL,
+	100'000'000'000'000'000ULL,
+	1'000'000'000'000'000'000ULL,
+	10'000'000'000'000'000'000ULL,
+};
+
+// Returns number of significant bits in value
+template <typename T>
+static int find_bits_count(T value)
 {
-	UIntType div_value = 0;
+	if (value == 0) return 0;
 
-	switch (base)
+#if defined (__GNUC__)
+	if (sizeof(T) > sizeof(unsigned long))
+		return (int)(8 * sizeof(unsigned long long)) - __builtin_clzll(value);
+	else
+		return (int)(8 * sizeof(unsigned long)) - __builtin_clzl((unsigned long)value);
+#elif defined (_MSC_VER)
+	unsigned long index = 0;
+	if ((sizeof(T) > 4) && (((uint64_t)value >> 32) != 0))
 	{
-	case 2:
-#ifdef MICRO_FORMAT_INT64
-		div_value = 1ULL << 63;
+		_BitScanReverse(&index, (unsigned long)((uint64_t)value >> 32));
+		return (int)index + 33;
+	}
+	_BitScanReverse(&index, (unsigned long)value);
+	return (int)index + 1;
 #else
-		div_value = 1UL << 31;
+	int result = 0;
+	while (value) { value >>= 1; result++; }
+	return result;
 #endif
-		break;
+}
 
-	case 8:
-#ifdef MICRO_FORMAT_INT64
-		div_value = 1LL << (3 * 21);
-#else
-		div_value = 3UL << (3 * 10);
-#endif
-		break;
+// Number of decimal digits. 1233/4096 is approximation of log10(2)
+template <typename T>
+static int find_dec_len(T value)
+{
+	int len = (find_bits_count(value) * 1233) >> 12;
+	if (value >= pow10_table[len]) len++;
+	return len ? len : 1;
+}
 
-	case 10:
-#ifdef MICRO_FORMAT_INT64
-		div_value = 10'000'000'000'000'000'000ULL;
-#else
-		div_value = 1'000'000'000UL;
-#endif
-		break;
+// Writes len decimal digits of 32-bit value into text by two digits per step
+static void write_dec_digits_u32(char* text, uint32_t value, int len)
+{
+	char* ptr = text + len;
 
-	case 16:
-#ifdef MICRO_FORMAT_INT64
-		div_value = 1ULL << (4 * 15);
-#else
-		div_value = 1UL << (4 * 7);
-#endif
-		break;
+	while (value >= 100)
+	{
+		unsigned pair = (value % 100) * 2;
+		value /= 100;
+		*--ptr = dec_digits_pairs[pair + 1];
+		*--ptr = dec_digits_pairs[pair];
+	}
+
+	if (value >= 10)
+	{
+		unsigned pair = value * 2;
+		*--ptr = dec_digits_pairs[pair + 1];
+		*--ptr = dec_digits_pairs[pair];
 	}
+	else
+		*--ptr = (char)('0' + value);
+}
 
-	while ((div_value > value) && (div_value >= base))
-		div_value /= base;
+// Writes 9 decimal digits of value < 10^9 including leading zeros
+static void write_dec_chunk(char* text, uint32_t value)
+{
+	char* ptr = text + 9;
 
-	for (;;)
+	for (int i = 0; i < 4; i++)
+	{
+		unsigned pair = (value % 100) * 2;
+		value /= 100;
+		*--ptr = dec_digits_pairs[pair + 1];
+		*--ptr = dec_digits_pairs[pair];
+	}
+
+	*--ptr = (char)('0' + value);
+}
+
+// Writes len decimal digits of value into text. Value wider than 32 bits is
+// split into chunks of 9 digits by one or two 64-bit divisions by 10^9 and
+// digits of chunks are written by 32-bit arithmetic (64-bit division is
+// library call on 32-bit targets)
+template <typename T>
+static void write_dec_digits(char* text, T value, int len)
+{
+	uint64_t value64 = (uint64_t)value;
+	char* ptr = text + len;
+
+	while ((value64 >> 32) != 0)
 	{
-		unsigned value_to_print = (unsigned)(value / div_value);
+		uint64_t high = value64 / 1'000'000'000U;
+		ptr -= 9;
+		write_dec_chunk(ptr, (uint32_t)(value64 - high * 1'000'000'000U));
+		value64 = high;
+	}
+
+	write_dec_digits_u32(text, (uint32_t)value64, (int)(ptr - text));
+}
+
+static void print_uint_dec(DstData& dst, UIntType value)
+{
+	char text[3 * sizeof(UIntType)];
+	int len = find_dec_len(value);
+	write_dec_digits(text, value, len);
+	put_chars(dst, text, len);
+}
+
+static const char pow2_digits[] = "0123456789abcdef0123456789ABCDEF";
+
+// Number of digits for base 2^shift (shift is 1, 3 or 4). Computed by bit width only
+static int find_pow2_len(UIntType value, unsigned shift)
+{
+	int bits = find_bits_count(value);
+	if (bits == 0) return 1;
 
-		char char_to_print =
-			(value_to_print < 10)
-			? (value_to_print + '0')
-			: (value_to_print - 10 + (upper_case ? 'A' : 'a'));
+	switch (shift)
+	{
+	case 1:  return bits;
+	case 3:  return (bits + 2) / 3;
+	default: return (bits + 3) >> 2;
+	}
+}
 
-		put_char(dst, char_to_print);
+// Writes len digits of value for base 2^shift into text by shifting and masking
+static void write_pow2_digits(char* text, UIntType value, int len, unsigned shift, bool upper_case)
+{
+	const char* digits = upper_case ? (pow2_digits + 16) : pow2_digits;
+	unsigned mask = (1U << shift) - 1;
+	char* ptr = text + len;
 
-		value -= value_to_print * div_value;
-		div_value /= base;
+	do
+	{
+		*--ptr = digits[(unsigned)value & mask];
+		value >>= shift;
+	} while (ptr != text);
+}
 
-		if (div_value == 0) break;
+static void print_uint_impl(DstData& dst, UIntType value, unsigned base, bool upper_case)
+{
+	if (base == 10)
+	{
+		print_uint_dec(dst, value);
+		return;
 	}
+
+	unsigned shift = (base == 2) ? 1 : (base == 8) ? 3 : 4;
+	char text[8 * sizeof(UIntType)];
+	int len = find_pow2_len(value, shift);
+	write_pow2_digits(text, value, len, shift, upper_case);
+	put_chars(dst, text, len);
 }
 
 static int find_uint_len(UIntType value, unsigned base)
 {
-	unsigned int len = 0;
-	while (value != 0) { value /= base; len++; }
-	if (len == 0) len = 1;
-	return len;
+	switch (base)
+	{
+	case 2:  return find_pow2_len(value, 1);
+	case 8:  return find_pow2_len(value, 3);
+	case 16: return find_pow2_len(value, 4);
+	default: return find_dec_len(value);
+	}
 }
 
 static void print_uint_generic(FormatCtx& ctx, const FormatSpec& format_spec, UIntType value, bool is_negative)
@@ -483,7 +656,7 @@ static void print_uint_generic(FormatCtx& ctx, const FormatSpec& format_spec, UI
 	unsigned char len = find_uint_len(value, base);
 	if (format_spec.flags.octothorp)
 	{
-		if ((format_spec.format == 'x') || (format_spec.format == 'b'))
+		if ((format_spec.format == 'x') || (format_spec.format == 'p') || (format_spec.format == 'b'))
 			len += 2;
 		else if (format_spec.format == 'o')
 			len++;
@@ -491,6 +664,12 @@ static void print_uint_generic(FormatCtx& ctx, const FormatSpec& format_spec, UI
 
 	if (is_negative || (format_spec.sign == '+') || (format_spec.sign == ' ')) len++;
 
+	if (is_counting_only(ctx.dst))
+	{
+		count_field(ctx, format_spec, len);
+		return;
+	}
+
 	// sign, format specifier and leading spaces or zeros
 	print_sign_and_leading_spaces(ctx, format_spec, is_negative, len, false);
 
@@ -510,9 +689,54 @@ static void print_char(FormatCtx& ctx, const FormatSpec& format_spec, char value
 		print_uint_generic(ctx, format_spec, (unsigned)value, false);
 }
 
+// Length of string in bytes limited by precision. Precision is number of
+// code points for utf8 destination. Characters after precision are not read
+static int get_str_len(const DstData& dst, const char* str, int precision)
+{
+	if (precision < 0) return strlen(str);
+	int len = 0;
+
+	if (!dst.utf8_width)
+	{
+		while ((len < precision) && str[len]) len++;
+		return len;
+	}
+
+	for (int chars = 0; str[len]; len++)
+	{
+		if (is_utf8_continuation(str[len])) continue;
+		if (chars == precision) break;
+		chars++;
+	}
+
+	return len;
+}
+
+// The same for string of known length
+static size_t get_str_len(const DstData& dst, const char* str, size_t len, int precision)
+{
+	if (precision < 0) return len;
+	if (!dst.utf8_width) return (len < (size_t)precision) ? len : precision;
+
+	size_t pos = 0;
+	for (int chars = 0; pos < len; pos++)
+	{
+		if (is_utf8_continuation(str[pos])) continue;
+		if (chars == precision) break;
+		chars++;
+	}
+
+	return pos;
+}
+
 static void print_string(FormatCtx& ctx, const FormatSpec& format_spec, const char* str)
 {
-	print_string_impl(ctx, format_spec, str, false);
+	print_string_impl(ctx, format_spec, str, get_str_len(ctx.dst, str, format_spec.precision), false);
+}
+
+static void print_string(FormatCtx& ctx, const FormatSpec& format_spec, const char* str, size_t len)
+{
+	print_string_impl(ctx, format_spec, str, (int)get_str_len(ctx.dst, str, len, format_spec.precision), false);
 }
 
 static void print_int(FormatCtx& ctx, const FormatSpec& format_spec, IntType value)
@@ -549,7 +773,7 @@ static void print_uint(FormatCtx& ctx, const FormatSpec& format_spec, UIntType v
 static void print_bool(FormatCtx& ctx, const FormatSpec& format_spec, bool value)
 {
 	if ((format_spec.format == 's') || (format_spec.format == 0))
-		print_string_impl(ctx, format_spec, value ? "true" : "false", false);
+		print_string_impl(ctx, format_spec, value ? "true" : "false", value ? 4 : 5, false);
 	else
 		print_uint_generic(ctx, format_spec, (unsigned char)value, false);
 }
@@ -562,38 +786,539 @@ static void print_pointer(FormatCtx& ctx, const FormatSpec& format_spec, uintptr
 
 #if defined (MICRO_FORMAT_FLOAT) || defined (MICRO_FORMAT_DOUBLE)
 
-struct PrintFloatData
-{
-	FloatType positive_value = {};
-	FloatType round_div = {};
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+
+// Shortest and correctly rounded decimal digits of binary floating point numbers
+// by Ryu algorithm (Ulf Adams, https://github.com/ulfjack/ryu). To save flash
+// only every 26th power of 5 is stored, others are computed with correction
+// taken from *_offsets tables (2 bits per power)
+
+static const int pow5_bitcount = 125;
+static const int pow5_inv_bitcount = 125;
+
+// 5^i for i in [0, 26)
+static const uint64_t pow5_table[26] = {
+	1ULL, 5ULL, 25ULL,
+	125ULL, 625ULL, 3125ULL,
+	15625ULL, 78125ULL, 390625ULL,
+	1953125ULL, 9765625ULL, 48828125ULL,
+	244140625ULL, 1220703125ULL, 6103515625ULL,
+	30517578125ULL, 152587890625ULL, 762939453125ULL,
+	3814697265625ULL, 19073486328125ULL, 95367431640625ULL,
+	476837158203125ULL, 2384185791015625ULL, 11920928955078125ULL,
+	59604644775390625ULL, 298023223876953125ULL,
+};
+
+static const uint64_t pow5_split[13][2] = {
+	{ 0x0000000000000000ULL, 0x1000000000000000ULL },
+	{ 0x0000000000000000ULL, 0x14ADF4B7320334B9ULL },
+	{ 0x0E549208B31ADB10ULL, 0x1ABA4714957D300DULL },
+	{ 0x6DC6AD264D8F0866ULL, 0x1145B7E285BF98F5ULL },
+	{ 0xEB1DBD923D8596CAULL, 0x1652EFDC6018A1FCULL },
+	{ 0xB4C1B80B22AE923CULL, 0x1CDA62055B2D9D83ULL },
+	{ 0x5BB28B4E8F7E4C30ULL, 0x12A5568B9F52F416ULL },
+	{ 0xF08AED437682D4FBULL, 0x1819651531F9E78FULL },
+	{ 0xB4EE134AD99BF150ULL, 0x1F25C186A6F04C28ULL },
+	{ 0x16499ECB70C25F03ULL, 0x1420EB449C8842E6ULL },
+	{ 0x85A56EAD360865B0ULL, 0x1A03FDE214CAF085ULL },
+	{ 0x093DB1D57999890BULL, 0x10CFEB353A97DAD8ULL },
+	{ 0xCF38BB735E3F36ACULL, 0x15BAAF44FA52673EULL },
+};
+
+static const uint64_t pow5_inv_split[13][2] = {
+	{ 0x0000000000000001ULL, 0x2000000000000000ULL },
+	{ 0x52A6C95FC0655034ULL, 0x18C240C4AECB13BBULL },
+	{ 0x7CA8D50071DFC806ULL, 0x1327FC58DA0F6FF5ULL },
+	{ 0x6520247D3556476EULL, 0x1DA48CE468E7C702ULL },
+	{ 0x6139CDD76802E6E9ULL, 0x16EF5B40C2FC7779ULL },
+	{ 0xF951A7FF43DE8C79ULL, 0x11BEBDF578B2F391ULL },
+	{ 0x7BE8BEE8D6E957E8ULL, 0x1B758D848FAC54B0ULL },
+	{ 0x8BD3F9E999A423EAULL, 0x153EDA614071A3B7ULL },
+	{ 0x0848F973CB3EE3CEULL, 0x10701BD527B4978CULL },
+	{ 0x153285EBB9EFBFA2ULL, 0x196FBB9BB44DB44DULL },
+	{ 0xADEEE7F86C07B696ULL, 0x13AE3591F5B4D936ULL },
+	{ 0x4D686A4EAF182222ULL, 0x1E74404F3DAADA91ULL },
+	{ 0x98C0A106E09EBD9FULL, 0x17900EA4FDA7C257ULL },
+};
+
+static const uint32_t pow5_offsets[21] = {
+	0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x40000000, 0x59695995, 0x55545555, 0x56555515,
+	0x41150504, 0x40555410, 0x44555145, 0x44504540,
+	0x45555550, 0x40004000, 0x96440440, 0x55565565,
+	0x54454045, 0x40154151, 0x55559155, 0x51405555,
+	0x00000105,
+};
+
+static const uint32_t pow5_inv_offsets[19] = {
+	0x54544554, 0x04055545, 0x10041000, 0x00400414,
+	0x40010000, 0x41155555, 0x00000454, 0x00010044,
+	0x40000000, 0x44000041, 0x50454450, 0x55550054,
+	0x51655554, 0x40004000, 0x01000001, 0x00010500,
+	0x51515411, 0x05555554, 0x00000000,
+};
+
+// Number of bits in 5^e (e > 0)
+static int pow5_bits(int e)
+{
+	return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e))
+static int log10_pow2(int e)
+{
+	return (int)(((uint32_t)e * 78913) >> 18);
+}
+
+// floor(log10(5^e))
+static int log10_pow5(int e)
+{
+	return (int)(((uint32_t)e * 732923) >> 20);
+}
+
+#if defined (__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 UInt128;
+#endif
+
+static uint64_t umul128(uint64_t a, uint64_t b, uint64_t& high)
+{
+#if defined (__SIZEOF_INT128__)
+	UInt128 result = (UInt128)a * b;
+	high = (uint64_t)(result >> 64);
+	return (uint64_t)result;
+#else
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+	uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t b00 = a_lo * b_lo;
+	uint64_t b01 = a_lo * b_hi;
+	uint64_t b10 = a_hi * b_lo;
+	uint64_t b11 = a_hi * b_hi;
+	uint64_t mid1 = b10 + (b00 >> 32);
+	uint64_t mid2 = b01 + (uint32_t)mid1;
+	high = b11 + (mid1 >> 32) + (mid2 >> 32);
+	return (mid2 << 32) | (uint32_t)b00;
+#endif
+}
+
+// (high:low) >> dist for 0 < dist < 64
+static uint64_t shift_right128(uint64_t low, uint64_t high, int dist)
+{
+	return (high << (64 - dist)) | (low >> dist);
+}
+
+// Multiplies 5^offset by 125-bit value and shifts result to 125 bits
+static void mul_pow5_split(const uint64_t (&mul)[2], int offset, int shift, uint32_t corr, uint64_t (&result)[2])
+{
+	uint64_t high1;
+	uint64_t low1 = umul128(pow5_table[offset], mul[1], high1);
+	uint64_t high0;
+	uint64_t low0 = umul128(pow5_table[offset], mul[0], high0);
+	uint64_t sum = high0 + low1;
+	if (sum < high0) ++high1;
+
+	result[0] = shift_right128(low0, sum, shift) + corr;
+	result[1] = shift_right128(sum, high1, shift) + (result[0] < corr);
+}
+
+// Top 125 bits of 5^i
+static void compute_pow5(int i, uint64_t (&result)[2])
+{
+	int base = i / 26;
+	int base2 = base * 26;
+	int offset = i - base2;
+	const uint64_t (&mul)[2] = pow5_split[base];
+
+	if (offset == 0)
+	{
+		result[0] = mul[0];
+		result[1] = mul[1];
+		return;
+	}
+
+	uint32_t corr = (pow5_offsets[i / 16] >> ((i % 16) << 1)) & 3;
+	mul_pow5_split(mul, offset, pow5_bits(i) - pow5_bits(base2), corr, result);
+}
+
+// 2^(pow5_bits(i) - 1 + 125) / 5^i + 1
+static void compute_inv_pow5(int i, uint64_t (&result)[2])
+{
+	int base = (i + 25) / 26;
+	int base2 = base * 26;
+	int offset = base2 - i;
+	const uint64_t (&inv)[2] = pow5_inv_split[base];
+
+	if (offset == 0)
+	{
+		result[0] = inv[0];
+		result[1] = inv[1];
+		return;
+	}
+
+	uint64_t mul[2] = { inv[0] - 1, inv[1] - (inv[0] == 0) };
+	uint32_t corr = (pow5_inv_offsets[i / 16] >> ((i % 16) << 1)) & 3;
+	mul_pow5_split(mul, offset, pow5_bits(base2) - pow5_bits(i), corr + 1, result);
+}
+
+// (m * mul) >> j for j > 64
+static uint64_t mul_shift64(uint64_t m, const uint64_t (&mul)[2], int j)
+{
+	uint64_t high1;
+	uint64_t low1 = umul128(m, mul[1], high1);
+	uint64_t high0;
+	umul128(m, mul[0], high0);
+	uint64_t sum = high0 + low1;
+	if (sum < high0) ++high1;
+	return shift_right128(sum, high1, j - 64);
+}
+
+static bool multiple_of_pow5(uint64_t value, int p)
+{
+	int count = 0;
+	while ((count < p) && (value % 5 == 0))
+	{
+		value /= 5;
+		count++;
+	}
+	return count >= p;
+}
+
+static bool multiple_of_pow2(uint64_t value, int p)
+{
+	return (p < 64) && ((value & ((1ULL << p) - 1)) == 0);
+}
+
+// Decimal number digits * 10^exponent
+struct DecimalFloat
+{
+	uint64_t digits = 0;
+	int exponent = 0;
+};
+
+// Decimal interval of the binary number: vr is number, vp and vm are
+// halfway points to neighbours. All are scaled by 10^-e10
+struct RyuInterval
+{
+	uint64_t vr = 0;
+	uint64_t vp = 0;
+	uint64_t vm = 0;
+	int e10 = 0;
+	bool accept_bounds = false;
+	bool vm_is_trailing_zeros = false;
+	bool vr_is_trailing_zeros = false;
+	bool vr_is_exact = false;
+};
+
+static void get_ryu_interval(uint64_t ieee_mantissa, int ieee_exponent, int mantissa_bits, int exponent_bias, RyuInterval& r)
+{
+	int e2;
+	uint64_t m2;
+
+	if (ieee_exponent == 0)
+	{
+		e2 = 1 - exponent_bias - mantissa_bits - 2;
+		m2 = ieee_mantissa;
+	}
+	else
+	{
+		e2 = ieee_exponent - exponent_bias - mantissa_bits - 2;
+		m2 = (1ULL << mantissa_bits) | ieee_mantissa;
+	}
+
+	r.accept_bounds = (m2 & 1) == 0;
+
+	uint64_t mv = 4 * m2;
+	uint32_t mm_shift = (ieee_mantissa != 0) || (ieee_exponent <= 1);
+	uint64_t pow5[2];
+	int q = 0;
+	int j = 0;
+
+	if (e2 >= 0)
+	{
+		q = log10_pow2(e2) - (e2 > 3);
+		r.e10 = q;
+		j = -e2 + q + pow5_inv_bitcount + pow5_bits(q) - 1;
+		compute_inv_pow5(q, pow5);
+	}
+	else
+	{
+		q = log10_pow5(-e2) - (-e2 > 1);
+		r.e10 = q + e2;
+		int i = -e2 - q;
+		j = q - (pow5_bits(i) - pow5_bitcount);
+		compute_pow5(i, pow5);
+	}
+
+	r.vr = mul_shift64(mv, pow5, j);
+	r.vp = mul_shift64(mv + 2, pow5, j);
+	r.vm = mul_shift64(mv - 1 - mm_shift, pow5, j);
+
+	if (e2 >= 0)
+	{
+		r.vr_is_exact = multiple_of_pow5(mv, q);
+
+		if (q <= 21)
+		{
+			if (mv % 5 == 0)
+				r.vr_is_trailing_zeros = r.vr_is_exact;
+			else if (r.accept_bounds)
+				r.vm_is_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+			else
+				r.vp -= multiple_of_pow5(mv + 2, q);
+		}
+	}
+	else
+	{
+		r.vr_is_exact = multiple_of_pow2(mv, q);
+
+		if (q <= 1)
+		{
+			r.vr_is_trailing_zeros = true;
+			if (r.accept_bounds)
+				r.vm_is_trailing_zeros = (mm_shift == 1);
+			else
+				--r.vp;
+		}
+		else if (q < 63)
+			r.vr_is_trailing_zeros = r.vr_is_exact;
+	}
+}
+
+// Shortest digits which are read back to the same binary number
+static DecimalFloat get_shortest_digits(RyuInterval r)
+{
+	int removed = 0;
+	unsigned last_removed_digit = 0;
+	uint64_t output;
+
+	if (r.vm_is_trailing_zeros || r.vr_is_trailing_zeros)
+	{
+		while (r.vp / 10 > r.vm / 10)
+		{
+			r.vm_is_trailing_zeros &= (r.vm % 10 == 0);
+			r.vr_is_trailing_zeros &= (last_removed_digit == 0);
+			last_removed_digit = (unsigned)(r.vr % 10);
+			r.vr /= 10;
+			r.vp /= 10;
+			r.vm /= 10;
+			removed++;
+		}
+
+		if (r.vm_is_trailing_zeros)
+		{
+			while (r.vm % 10 == 0)
+			{
+				r.vr_is_trailing_zeros &= (last_removed_digit == 0);
+				last_removed_digit = (unsigned)(r.vr % 10);
+				r.vr /= 10;
+				r.vp /= 10;
+				r.vm /= 10;
+				removed++;
+			}
+		}
+
+		// round to even if exactly halfway
+		if (r.vr_is_trailing_zeros && (last_removed_digit == 5) && (r.vr % 2 == 0))
+			last_removed_digit = 4;
+
+		output = r.vr + (((r.vr == r.vm) && (!r.accept_bounds || !r.vm_is_trailing_zeros)) || (last_removed_digit >= 5));
+	}
+	else
+	{
+		bool round_up = false;
+
+		if (r.vp / 100 > r.vm / 100)
+		{
+			round_up = (r.vr % 100) >= 50;
+			r.vr /= 100;
+			r.vp /= 100;
+			r.vm /= 100;
+			removed += 2;
+		}
+
+		while (r.vp / 10 > r.vm / 10)
+		{
+			round_up = (r.vr % 10) >= 5;
+			r.vr /= 10;
+			r.vp /= 10;
+			r.vm /= 10;
+			removed++;
+		}
+
+		output = r.vr + ((r.vr == r.vm) || round_up);
+	}
+
+	DecimalFloat result;
+	result.digits = output;
+	result.exponent = r.e10 + removed;
+	return result;
+}
+
+// First digits_count digits rounded to nearest (to even for exact halves).
+// If vr has not enough digits, less digits are returned
+static DecimalFloat get_rounded_digits(const RyuInterval& r, int digits_count)
+{
+	int len = find_dec_len(r.vr);
+	int drop = len - digits_count;
+	if (drop < 1) drop = 1;
+
+	uint64_t divider = pow10_table[drop];
+	uint64_t digits = r.vr / divider;
+	uint64_t remainder = r.vr % divider;
+	uint64_t half = divider / 2;
+
+	if ((remainder > half) || ((remainder == half) && (!r.vr_is_exact || (digits & 1))))
+		digits++;
+
+	DecimalFloat result;
+	result.digits = digits;
+	result.exponent = r.e10 + drop;
+
+	if (digits == pow10_table[len - drop])
+	{
+		result.digits /= 10;
+		result.exponent++;
+	}
+
+	return result;
+}
+
+static void get_double_interval(double value, RyuInterval& result)
+{
+	uint64_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	get_ryu_interval(bits & ((1ULL << 52) - 1), (int)((bits >> 52) & 0x7FF), 52, 1023, result);
+}
+
+static void get_single_interval(float value, RyuInterval& result)
+{
+	uint32_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	get_ryu_interval(bits & ((1UL << 23) - 1), (int)((bits >> 23) & 0xFF), 23, 127, result);
+}
+
+#endif
+
+struct PrintFloatData
+{
+	FloatType positive_value = {};
+	FloatType round_div = {};
 	FloatType integral_div = {};
 	int integral_len = {};
 	bool is_negative {};
 	const char* nan_text = nullptr;
+
+	// integral and fractional parts scaled by 10^precision
+	// if value and precision fit into UIntType
+	bool is_scaled = false;
+	UIntType integral = 0;
+	UIntType fraction = 0;
 };
 
-static void gather_data_to_print_float(FloatType value, int precision, bool upper_case, PrintFloatData &result)
+// 10^precision must fit into UIntType and scaled fractional part must be
+// exactly representable by FloatType
+static const int max_scaled_precision =
+	(std::numeric_limits<UIntType>::digits10 < std::numeric_limits<FloatType>::digits10)
+	? std::numeric_limits<UIntType>::digits10
+	: std::numeric_limits<FloatType>::digits10;
+
+// Returns rounding error of product = a * b (exact a * b - product)
+static FloatType get_product_error(FloatType a, FloatType b, FloatType product)
 {
-	if (isnan(value))
+#if defined (FMA)
+	return FMA(a, b, -product);
+#elif (FLT_EVAL_METHOD == 0)
+	// Dekker's algorithm: factors are split into halves which products are exact.
+	// It requires operations in declared precision and no contraction of
+	// multiply and add into FMA (compilers contract only if target has FMA
+	// instruction and then FMA branch is used)
+	const FloatType splitter = (FloatType)((1UL << ((std::numeric_limits<FloatType>::digits + 1) / 2)) + 1);
+
+	FloatType a_split = splitter * a;
+	FloatType a_high = a_split - (a_split - a);
+	FloatType a_low = a - a_high;
+
+	FloatType b_split = splitter * b;
+	FloatType b_high = b_split - (b_split - b);
+	FloatType b_low = b - b_high;
+
+	return (((a_high * b_high - product) + a_high * b_low) + a_low * b_high) + a_low * b_low;
+#else
+	// excess precision (x87): error is not taken into account
+	(void)a;
+	(void)b;
+	(void)product;
+	return 0;
+#endif
+}
+
+// Splits value into integer part and fractional part multiplied by 10^precision.
+// Rounding to nearest (to even for exact halves) is made once. Rounding error
+// of multiplication is taken into account to make same result as printf
+static bool gather_scaled_float(FloatType value, int precision, PrintFloatData &result)
+{
+	if ((precision > max_scaled_precision) ||
+	    (value >= (FloatType)std::numeric_limits<UIntType>::max()))
+		return false;
+
+	UIntType integral = (UIntType)value;
+	FloatType fract_part = value - (FloatType)integral;
+	FloatType scale = (FloatType)pow10_table[precision];
+	FloatType scaled = fract_part * scale;
+	FloatType scale_error = get_product_error(fract_part, scale, scaled);
+	UIntType fraction = (UIntType)scaled;
+
+	// sign of (exact remainder - 0.5)
+	FloatType round_diff = (scaled - (FloatType)fraction - (FloatType)0.5f) + scale_error;
+
+	UIntType last_digit = precision ? fraction : integral;
+
+	if ((round_diff > 0) || ((round_diff == 0) && (last_digit & 1)))
+		fraction++;
+
+	if (fraction == (UIntType)pow10_table[precision])
 	{
-		result.nan_text = upper_case ? "NAN" : "nan";
-		return;
+		fraction = 0;
+		integral++;
 	}
 
+	result.is_scaled = true;
+	result.integral = integral;
+	result.fraction = fraction;
+	result.integral_len = find_dec_len(integral);
+
+	return true;
+}
+
+// Returns text for nan, +inf or -inf and nullptr for other values
+static const char* get_float_nan_text(FloatType value, bool upper_case, bool& is_negative)
+{
+	if (isnan(value))
+		return upper_case ? "NAN" : "nan";
+
 	bool is_p_inf = (value > std::numeric_limits<FloatType>::max());
 	bool is_n_inf = (value < std::numeric_limits<FloatType>::lowest());
 
 	if (is_p_inf || is_n_inf) // +inf or -inf
 	{
-		result.nan_text = upper_case ? "INF" : "inf";
-		result.is_negative = is_n_inf;
-		return;
+		is_negative = is_n_inf;
+		return upper_case ? "INF" : "inf";
 	}
 
+	return nullptr;
+}
+
+static void gather_data_to_print_float(FloatType value, int precision, bool upper_case, PrintFloatData &result)
+{
+	result.nan_text = get_float_nan_text(value, upper_case, result.is_negative);
+	if (result.nan_text) return;
+
 	result.is_negative = value < (FloatType)0.0f;
 	if (result.is_negative)
 		value = -value;
 
+	if (gather_scaled_float(value, precision, result))
+		return;
+
 	// calculate data for rounding last decimal digit
 
 	result.round_div = (FloatType)1.0f;
@@ -623,8 +1348,36 @@ static void gather_data_to_print_float(FloatType value, int precision, bool uppe
 	}
 }
 
+static void printf_scaled_float_number(const PrintFloatData &data, DstData &dst, int precision)
+{
+	char text[6 * sizeof(UIntType) + 1];
+
+	write_dec_digits(text, data.integral, data.integral_len);
+	int len = data.integral_len;
+
+	if (precision)
+	{
+		text[len++] = '.';
+
+		for (int i = 0; i < precision; i++)
+			text[len + i] = '0';
+
+		int fraction_len = find_dec_len(data.fraction);
+		write_dec_digits(text + len + precision - fraction_len, data.fraction, fraction_len);
+		len += precision;
+	}
+
+	put_chars(dst, text, len);
+}
+
 static void printf_float_number(const PrintFloatData &data, DstData &dst, int precision)
 {
+	if (data.is_scaled)
+	{
+		printf_scaled_float_number(data, dst, precision);
+		return;
+	}
+
 	// print integral part
 
 	auto value = data.positive_value + (FloatType)0.5f / data.round_div;
@@ -658,8 +1411,205 @@ static void printf_float_number(const PrintFloatData &data, DstData &dst, int pr
 	}
 }
 
-static void print_float(FormatCtx& ctx, const FormatSpec& format_spec, FloatType value)
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+
+// Significant digits of number to print in scientific or fixed form
+struct FloatDigits
+{
+	char text[20];
+	int len = 0;
+	int exp10 = 0;      // decimal exponent of first digit
+	int frac_len = 0;   // digits after point
+	bool scientific = false;
+};
+
+static void set_float_digits(DecimalFloat dec, bool strip_zeros, FloatDigits& result)
+{
+	result.len = find_dec_len(dec.digits);
+
+	if (strip_zeros)
+	{
+		while ((result.len > 1) && (dec.digits % 10 == 0))
+		{
+			dec.digits /= 10;
+			dec.exponent++;
+			result.len--;
+		}
+	}
+
+	write_dec_digits(result.text, dec.digits, result.len);
+	result.exp10 = dec.exponent + result.len - 1;
+}
+
+static int get_fixed_len(const FloatDigits& digits)
+{
+	return
+		((digits.exp10 >= 0) ? (digits.exp10 + 1) : 1) +
+		(digits.frac_len ? (digits.frac_len + 1) : 0);
+}
+
+static int get_scientific_len(const FloatDigits& digits)
+{
+	int exp_abs = (digits.exp10 < 0) ? -digits.exp10 : digits.exp10;
+	return
+		1 +
+		(digits.frac_len ? (digits.frac_len + 1) : 0) +
+		2 + ((exp_abs >= 100) ? 3 : 2);
+}
+
+static int get_fixed_frac_len(const FloatDigits& digits)
+{
+	int result = digits.len - 1 - digits.exp10;
+	return (result > 0) ? result : 0;
+}
+
+// Fills digits for shortest, 'e' or 'g' presentation of positive value
+static void gather_float_digits(FloatType value, bool is_single, const FormatSpec& format_spec, FloatDigits& result)
+{
+	RyuInterval interval;
+	DecimalFloat dec;
+
+	if ((value != 0) && (format_spec.format == 0))
+	{
+		if (is_single)
+			get_single_interval((float)value, interval);
+		else
+			get_double_interval((double)value, interval);
+		dec = get_shortest_digits(interval);
+	}
+	else if (value != 0)
+	{
+		int digits_count =
+			(format_spec.format == 'e') ? format_spec.precision + 1 :
+			format_spec.precision ? format_spec.precision : 1;
+
+		get_double_interval((double)value, interval);
+		dec = get_rounded_digits(interval, digits_count);
+	}
+
+	switch (format_spec.format)
+	{
+	case 'e':
+		set_float_digits(dec, false, result);
+		result.scientific = true;
+		result.frac_len = format_spec.precision;
+		break;
+
+	case 'g':
+	{
+		int precision = format_spec.precision ? format_spec.precision : 1;
+		set_float_digits(dec, false, result);
+		result.scientific = (result.exp10 < -4) || (result.exp10 >= precision);
+		set_float_digits(dec, true, result);
+		result.frac_len = result.scientific ? (result.len - 1) : get_fixed_frac_len(result);
+		break;
+	}
+
+	default: // shortest form: fixed if it is not longer than scientific
+		set_float_digits(dec, true, result);
+		result.frac_len = result.len - 1;
+		int scientific_len = get_scientific_len(result);
+		result.frac_len = get_fixed_frac_len(result);
+		result.scientific = get_fixed_len(result) > scientific_len;
+		if (result.scientific) result.frac_len = result.len - 1;
+		break;
+	}
+}
+
+static void print_fixed_digits(DstData& dst, const FloatDigits& digits)
+{
+	int frac_digits = 0;
+
+	if (digits.exp10 >= 0)
+	{
+		int int_digits = (digits.len < digits.exp10 + 1) ? digits.len : (digits.exp10 + 1);
+		put_chars(dst, digits.text, int_digits);
+		put_fill(dst, '0', digits.exp10 + 1 - int_digits);
+		if (digits.frac_len) put_char(dst, '.');
+		frac_digits = digits.len - int_digits;
+		put_chars(dst, digits.text + int_digits, frac_digits);
+	}
+	else
+	{
+		put_chars(dst, "0.", 2);
+		put_fill(dst, '0', -digits.exp10 - 1);
+		put_chars(dst, digits.text, digits.len);
+		frac_digits = digits.len - digits.exp10 - 1;
+	}
+
+	put_fill(dst, '0', digits.frac_len - frac_digits);
+}
+
+static void print_scientific_digits(DstData& dst, const FloatDigits& digits, bool upper_case)
+{
+	put_char(dst, digits.text[0]);
+
+	if (digits.frac_len)
+	{
+		put_char(dst, '.');
+		put_chars(dst, digits.text + 1, digits.len - 1);
+		put_fill(dst, '0', digits.frac_len - (digits.len - 1));
+	}
+
+	int exp_abs = (digits.exp10 < 0) ? -digits.exp10 : digits.exp10;
+	char text[5] = { upper_case ? 'E' : 'e', (digits.exp10 < 0) ? '-' : '+', '0' };
+	int len = (exp_abs >= 100) ? 3 : 2;
+	write_dec_digits(text + 2, exp_abs, len);
+	put_chars(dst, text, len + 2);
+}
+
+static void print_float_digits(FormatCtx& ctx, const FormatSpec& format_spec, FloatType value, bool is_single)
 {
+	bool is_negative = value < (FloatType)0.0f;
+	if (is_negative) value = -value;
+
+	FloatDigits digits;
+	gather_float_digits(value, is_single, format_spec, digits);
+
+	int len = digits.scientific ? get_scientific_len(digits) : get_fixed_len(digits);
+	if (is_negative || (format_spec.sign == '+') || (format_spec.sign == ' ')) len++;
+
+	if (is_counting_only(ctx.dst))
+	{
+		count_field(ctx, format_spec, len);
+		return;
+	}
+
+	print_sign_and_leading_spaces(ctx, format_spec, is_negative, len, true);
+
+	if (digits.scientific)
+		print_scientific_digits(ctx.dst, digits, format_spec.flags.upper_case);
+	else
+		print_fixed_digits(ctx.dst, digits);
+
+	print_trailing_spaces(ctx, format_spec, len);
+}
+
+#endif
+
+static void print_float(FormatCtx& ctx, const FormatSpec& format_spec, FloatType value, bool is_single)
+{
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+	// shortest form, 'e' and 'g' presentations
+
+	if ((format_spec.format != 'f') && ((format_spec.format != 0) || (format_spec.precision == -1)))
+	{
+		bool is_negative = false;
+		const char* nan_text = get_float_nan_text(value, format_spec.flags.upper_case, is_negative);
+
+		if (nan_text)
+			print_string_impl(ctx, format_spec, nan_text, strlen(nan_text), is_negative);
+		else
+			print_float_digits(ctx, format_spec, value, is_single);
+
+		return;
+	}
+#else
+	(void)is_single;
+#endif
+
+	// 'f' presentation
+
 	PrintFloatData data{};
 
 	gather_data_to_print_float(value, format_spec.precision, format_spec.flags.upper_case, data);
@@ -668,7 +1618,7 @@ static void print_float(FormatCtx& ctx, const FormatSpec& format_spec, FloatType
 
 	if (data.nan_text)
 	{
-		print_string_impl(ctx, format_spec, data.nan_text, data.is_negative);
+		print_string_impl(ctx, format_spec, data.nan_text, strlen(data.nan_text), data.is_negative);
 		return;
 	}
 
@@ -689,6 +1639,12 @@ static void print_float(FormatCtx& ctx, const FormatSpec& format_spec, FloatType
 
 	len += format_spec.precision;
 
+	if (is_counting_only(ctx.dst))
+	{
+		count_field(ctx, format_spec, len);
+		return;
+	}
+
 	// print sign, leading spaces or zeros
 
 	print_sign_and_leading_spaces(ctx, format_spec, data.is_negative, len, true);
@@ -704,11 +1660,117 @@ static void print_float(FormatCtx& ctx, const FormatSpec& format_spec, FloatType
 
 #endif
 
+// Fixed-point number is printed by integer arithmetic only. Fractional digits
+// are exact digits of raw / 2^frac_bits, rounding is half to even (like printf).
+// Without precision the shortest form which is read back to the same raw value is printed
+static void print_fixed(FormatCtx& ctx, const FormatSpec& format_spec, Fixed value)
+{
+	bool is_negative = value.raw < 0;
+	uint32_t magnitude = is_negative ? 0U - (uint32_t)value.raw : (uint32_t)value.raw;
+	int frac_bits = value.frac_bits;
+	uint64_t one = (uint64_t)1 << frac_bits;
+	uint32_t int_part = (uint32_t)(magnitude >> frac_bits);
+	uint64_t rem = magnitude & (one - 1);
+
+	// fractional part of 2^-frac_bits has exactly frac_bits digits
+	char frac_digits[32];
+	int frac_len = 0;
+	int precision = format_spec.precision;
+	bool shortest = (precision == -1);
+	int max_len = (shortest || (precision > frac_bits)) ? frac_bits : precision;
+	uint64_t pow10 = 1;
+
+	while (frac_len < max_len)
+	{
+		// error of rounding to frac_len digits is less than half of 2^-frac_bits.
+		// It is always true for 10 digits as 10^10 > 2^33
+		uint64_t error = (rem < one - rem) ? rem : (one - rem);
+		if (shortest && (2 * error < pow10)) break;
+
+		rem *= 10;
+		frac_digits[frac_len++] = (char)('0' + (rem >> frac_bits));
+		rem &= one - 1;
+		pow10 *= 10;
+	}
+
+	int last_digit = frac_len ? frac_digits[frac_len - 1] : (int)int_part;
+	if ((2 * rem > one) || ((2 * rem == one) && (last_digit & 1)))
+	{
+		int i = frac_len - 1;
+		for (; i >= 0; i--)
+		{
+			if (frac_digits[i] != '9')
+			{
+				frac_digits[i]++;
+				break;
+			}
+			frac_digits[i] = '0';
+		}
+		if (i < 0) int_part++;
+	}
+
+	int zeros_count = (precision > frac_len) ? (precision - frac_len) : 0;
+	int frac_total = frac_len + zeros_count;
+	int int_len = find_dec_len(int_part);
+
+	int len = int_len + (frac_total ? frac_total + 1 : 0);
+	if (is_negative || (format_spec.sign == '+') || (format_spec.sign == ' ')) len++;
+
+	if (is_counting_only(ctx.dst))
+	{
+		count_field(ctx, format_spec, len);
+		return;
+	}
+
+	print_sign_and_leading_spaces(ctx, format_spec, is_negative, len, false);
+
+	char int_digits[10];
+	write_dec_digits(int_digits, int_part, int_len);
+	put_chars(ctx.dst, int_digits, int_len);
+
+	if (frac_total)
+	{
+		put_char(ctx.dst, '.');
+		put_chars(ctx.dst, frac_digits, frac_len);
+		put_fill(ctx.dst, '0', zeros_count);
+	}
+
+	print_trailing_spaces(ctx, format_spec, len);
+}
+
+// Custom formatter is called twice if width is set: first time to count characters
+static void print_custom(FormatCtx& ctx, const FormatSpec& format_spec, const CustomArg& arg)
+{
+	if (format_spec.width <= 0)
+	{
+		arg.format(ctx.dst, format_spec, arg.value);
+		return;
+	}
+
+	FormatSpec field_spec = format_spec;
+	if (field_spec.align == 0)
+		field_spec.align = '<';
+
+	DstData counter{ nullptr, nullptr, nullptr, 0, false, ctx.dst.utf8_width };
+	arg.format(counter, format_spec, arg.value);
+	int len = (int)counter.chars_printed;
+
+	if (is_counting_only(ctx.dst))
+	{
+		count_field(ctx, field_spec, len);
+		return;
+	}
+
+	print_leading_spaces(ctx, field_spec, len, true);
+	arg.format(ctx.dst, format_spec, arg.value);
+	print_trailing_spaces(ctx, field_spec, len);
+}
+
 static void print_by_argument_type(FormatCtx& ctx, const FormatSpec& format_spec)
 {
 	const auto &argr = ctx.args[format_spec.index];
 
-	switch (ctx.args[format_spec.index].type)
+	switch (unpack_arg_type(ctx.arg_types, format_spec.index))
 	{
 	case FormatArgType::Char:
 		print_char(ctx, format_spec, (char)argr.value.i);
@@ -734,13 +1796,25 @@ static void print_by_argument_type(FormatCtx& ctx, const FormatSpec& format_spec
 		print_string(ctx, format_spec, (const char*)argr.value.p);
 		break;
 
+	case FormatArgType::StrView:
+		print_string(ctx, format_spec, argr.value.str.str, argr.value.str.len);
+		break;
+
 	case FormatArgType::Pointer:
 		print_pointer(ctx, format_spec, argr.value.p);
 		break;
 
+	case FormatArgType::Custom:
+		print_custom(ctx, format_spec, argr.value.custom);
+		break;
+
 #if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
 	case FormatArgType::Float:
-		print_float(ctx, format_spec, argr.value.f);
+		print_float(ctx, format_spec, argr.value.f, sizeof(FloatType) == sizeof(float));
+		break;
+
+	case FormatArgType::SingleFloat:
+		print_float(ctx, format_spec, argr.value.f, true);
 		break;
 #endif
 	default:
@@ -748,6 +1822,40 @@ static void print_by_argument_type(FormatCtx& ctx, const FormatSpec& format_spec
 	}
 }
 
+// Width or precision from argument. Returns false for negative value
+static bool get_dynamic_value(FormatCtx& ctx, int arg_index, int& value)
+{
+	if (arg_index == -1) return true;
+
+	const auto& arg = ctx.args[arg_index];
+	bool is_signed = (unpack_arg_type(ctx.arg_types, arg_index) == FormatArgType::Int);
+	if (is_signed && (arg.value.i < 0)) return false;
+
+	UIntType arg_value = is_signed ? (UIntType)arg.value.i : arg.value.u;
+	if (arg_value > (UIntType)INT_MAX) return false;
+
+	value = (int)arg_value;
+	return true;
+}
+
+// Prints field with width and precision taken from arguments ("{:{}.{}}")
+static void print_field(FormatCtx& ctx, const FormatSpec& format_spec)
+{
+	if ((format_spec.width_index == -1) && (format_spec.precision_index == -1))
+	{
+		print_by_argument_type(ctx, format_spec);
+		return;
+	}
+
+	FormatSpec spec = format_spec;
+
+	if (get_dynamic_value(ctx, spec.width_index, spec.width) &&
+	    get_dynamic_value(ctx, spec.precision_index, spec.precision))
+		print_by_argument_type(ctx, spec);
+	else
+		print_error(ctx);
+}
+
 void format_impl(FormatCtx& ctx, const char* format_str)
 {
 	int index = 0;
@@ -755,24 +1863,30 @@ void format_impl(FormatCtx& ctx, const char* format_str)
 
 	for (;;)
 	{
+		const char* text = format_str;
+		format_str = find_text_end<true>(format_str);
+
+		put_chars(ctx.dst, text, format_str - text);
+
 		char chr = *format_str++;
-		if (chr == 0) break;
+		if ((chr == 0) || ctx.dst.is_full) break;
 
-		if (chr == '{')
+		// chr is '{' here
 		{
 			if (*format_str != '{')
 			{
 				FormatSpec spec {};
+				int next_index = index;
 
-				format_str = get_format_specifier(format_str, spec, index);
+				format_str = get_format_specifier(format_str, spec, next_index);
 
 				bool ok = spec.flags.parsed_ok && check_format_specifier(ctx, spec);
 
 				if (ok)
 				{
-					correct_format_specifier(ctx, spec);
-					print_by_argument_type(ctx, spec);
-					index++;
+					correct_format_specifier(spec, unpack_arg_type(ctx.arg_types, spec.index));
+					print_field(ctx, spec);
+					index = next_index;
 				}
 				else
 					print_error(ctx);
@@ -783,11 +1897,134 @@ void format_impl(FormatCtx& ctx, const char* format_str)
 				format_str++;
 			}
 		}
-		else
-			put_char(ctx.dst, chr);
+
+		// stop when block callback can't accept more text
+		if (ctx.dst.is_full) break;
 	}
 }
 
+void format_impl(FormatCtx& ctx, const FormatSegment* segments, size_t segments_count)
+{
+	ctx.dst.chars_printed = 0;
+
+	for (size_t i = 0; i < segments_count; i++)
+	{
+		const auto& segment = segments[i];
+
+		put_chars(ctx.dst, segment.text, segment.text_len);
+
+		if (segment.has_field)
+			print_field(ctx, segment.spec);
+
+		if (ctx.dst.is_full) break;
+	}
+}
+
+size_t parse_format_segments(const char* format_str, FormatSegment* segments, size_t max_count)
+{
+	size_t count = 0;
+
+	bool ok = for_each_format_segment(format_str, [&](const FormatSegment& segment) {
+		if (count < max_count)
+			segments[count] = segment;
+		count++;
+	});
+
+	return (ok && (count <= max_count)) ? count : 0;
+}
+
+void format_impl(FormatCtx& ctx, const char* format_str, const FormatSegment* segments, size_t segments_count)
+{
+	for (size_t i = 0; i < segments_count; i++)
+	{
+		if (segments[i].has_field && !check_format_specifier(ctx, segments[i].spec))
+		{
+			format_impl(ctx, format_str);
+			return;
+		}
+	}
+
+	ctx.dst.chars_printed = 0;
+
+	for (size_t i = 0; i < segments_count; i++)
+	{
+		const auto& segment = segments[i];
+
+		put_chars(ctx.dst, segment.text, segment.text_len);
+
+		if (segment.has_field)
+		{
+			FormatSpec spec = segment.spec;
+			correct_format_specifier(spec, unpack_arg_type(ctx.arg_types, spec.index));
+			print_field(ctx, spec);
+		}
+
+		if (ctx.dst.is_full) break;
+	}
+}
+
+bool parse_range_format(FormatCtx& ctx, const char* format_str, const char* separator, RangeFormat& result)
+{
+	// text with field and text after field
+	FormatSegment segments[2];
+	size_t count = parse_format_segments(format_str, segments, 2);
+
+	bool ok =
+		(count == 2) &&
+		segments[0].has_field &&
+		!segments[1].has_field &&
+		(segments[0].spec.width_index == -1) &&
+		(segments[0].spec.precision_index == -1) &&
+		check_format_specifier(ctx, segments[0].spec);
+
+	if (!ok)
+	{
+		print_error(ctx);
+		return false;
+	}
+
+	result.prefix = segments[0].text;
+	result.prefix_len = segments[0].text_len;
+	result.spec = segments[0].spec;
+	result.suffix = segments[1].text;
+	result.suffix_len = segments[1].text_len;
+	result.separator = separator;
+	result.separator_len = strlen(separator);
+
+	correct_format_specifier(result.spec, unpack_arg_type(ctx.arg_types, 0));
+	return true;
+}
+
+static void print_range_element_start(FormatCtx& ctx, const RangeFormat& range, size_t index)
+{
+	if (index != 0)
+		put_chars(ctx.dst, range.separator, range.separator_len);
+	put_chars(ctx.dst, range.prefix, range.prefix_len);
+}
+
+void print_range_value(FormatCtx& ctx, const RangeFormat& range, size_t index, IntType value)
+{
+	print_range_element_start(ctx, range, index);
+	print_int(ctx, range.spec, value);
+	put_chars(ctx.dst, range.suffix, range.suffix_len);
+}
+
+void print_range_value(FormatCtx& ctx, const RangeFormat& range, size_t index, UIntType value)
+{
+	print_range_element_start(ctx, range, index);
+	print_uint(ctx, range.spec, value);
+	put_chars(ctx.dst, range.suffix, range.suffix_len);
+}
+
+#if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
+void print_range_value(FormatCtx& ctx, const RangeFormat& range, size_t index, FloatType value, bool is_single)
+{
+	print_range_element_start(ctx, range, index);
+	print_float(ctx, range.spec, value, is_single);
+	put_chars(ctx.dst, range.suffix, range.suffix_len);
+}
+#endif
+
 bool format_buf_callback(void* data, char character)
 {
 	auto* sdata = (FormatBufData*)data;
@@ -799,81 +2036,191 @@ bool format_buf_callback(void* data, char character)
 	return true;
 }
 
-bool utf8_char_callback(void* data, char chr)
+size_t format_buf_block_callback(void* data, const char* text, size_t len)
+{
+	auto* sdata = (FormatBufData*)data;
+	if (len > sdata->buffer_size) len = sdata->buffer_size;
+
+	for (size_t i = 0; i < len; i++)
+		sdata->buffer[i] = text[i];
+
+	sdata->buffer += len;
+	sdata->buffer_size -= len;
+
+	return len;
+}
+
+// Passes decoded characters to callback. Returns false if callback doesn't accept all of them
+static bool put_wide_chars(Utf8Receiver* r, const WideChar* text, size_t len)
+{
+	if (r->block_cb)
+	{
+		size_t accepted = r->block_cb(r->cb_data, text, len);
+		r->chars_printed += accepted;
+		return accepted == len;
+	}
+
+	for (size_t i = 0; i < len; i++)
+		r->cb(r->cb_data, text[i]);
+	r->chars_printed += len;
+	return true;
+}
+
+// Length of run of ASCII characters (not more than max_len)
+static size_t find_ascii_len(const uint8_t* text, size_t max_len)
+{
+	size_t len = 0;
+
+#if defined (MF_SCAN_SSE2)
+	while (len + 16 <= max_len)
+	{
+		__m128i chars = _mm_loadu_si128((const __m128i*)(text + len));
+		unsigned mask = (unsigned)_mm_movemask_epi8(chars);
+		if (mask) return len + find_first_bit(mask);
+		len += 16;
+	}
+#elif defined (MF_SCAN_SWAR)
+	const uintptr_t high_bits = (uintptr_t)-1 / 0xFF * 0x80;
+	while (len + sizeof(uintptr_t) <= max_len)
+	{
+		uintptr_t word;
+		memcpy(&word, text + len, sizeof(word));
+		if (word & high_bits) break;
+		len += sizeof(uintptr_t);
+	}
+#endif
+
+	while ((len < max_len) && (text[len] < 0x80))
+		len++;
+
+	return len;
+}
+
+// Decodes utf8 text into blocks of wide characters. Sequence of characters
+// may be split between calls. Wrong byte gives wrong_char
+size_t utf8_block_callback(void* data, const char* text, size_t len)
 {
 	Utf8Receiver* r = (Utf8Receiver*)data;
 
-	bool ok = true;
+	const size_t buffer_size = 32;
+	WideChar buffer[buffer_size];
+	size_t count = 0;
 
-	if (r->count == 0)
+	auto* ptr = (const uint8_t*)text;
+	auto* end = ptr + len;
+
+	while (ptr != end)
 	{
-		if ((chr & 0b10000000) == 0)
+		if (count == buffer_size)
 		{
-			ok = r->cb(r->cb_data, chr);
-			r->chars_printed++;
+			if (!put_wide_chars(r, buffer, count)) return 0;
+			count = 0;
 		}
 
-		else if ((chr & 0b11100000) == 0b11000000)
+		if (r->count == 0)
 		{
-			r->character = chr & 0b00011111;
-			r->count = 1;
-		}
+			// run of ASCII characters
+			size_t max_len = buffer_size - count;
+			if ((size_t)(end - ptr) < max_len) max_len = end - ptr;
+			size_t ascii_len = find_ascii_len(ptr, max_len);
+			for (size_t i = 0; i < ascii_len; i++)
+				buffer[count++] = ptr[i];
+			ptr += ascii_len;
+			if ((ptr == end) || (count == buffer_size)) continue;
+
+			uint8_t chr = *ptr++;
+
+			if ((chr & 0b11100000) == 0b11000000)
+			{
+				r->character = chr & 0b00011111;
+				r->count = 1;
+			}
 
-		else if ((chr & 0b11110000) == 0b11100000)
-		{
-			r->character = chr & 0b00001111;
-			r->count = 2;
-		}
+			else if ((chr & 0b11110000) == 0b11100000)
+			{
+				r->character = chr & 0b00001111;
+				r->count = 2;
+			}
 
-		else if ((chr & 0b11111000) == 0b11110000)
-		{
-			r->character = chr & 0b00000111;
-			r->count = 3;
-		}
+			else if ((chr & 0b11111000) == 0b11110000)
+			{
+				r->character = chr & 0b00000111;
+				r->count = 3;
+			}
 
-		else
-		{
-			ok = r->cb(r->cb_data, r->wrong_char);
-			r->chars_printed++;
-		}
-	}
-	else
-	{
-		if ((chr & 0b11000000) != 0b10000000)
-		{
-			ok = r->cb(r->cb_data, r->wrong_char);
-			r->count = 0;
-			r->chars_printed++;
+			else
+				buffer[count++] = r->wrong_char;
 		}
 		else
 		{
-			r->character <<= 6;
-			r->character |= (chr & 0b00111111);
-			r->count--;
+			uint8_t chr = *ptr++;
 
-			if (r->count == 0)
+			if ((chr & 0b11000000) != 0b10000000)
 			{
-				ok = r->cb(r->cb_data, r->character);
-				r->chars_printed++;
+				buffer[count++] = r->wrong_char;
+				r->count = 0;
+			}
+			else
+			{
+				r->character <<= 6;
+				r->character |= (chr & 0b00111111);
+				r->count--;
+
+				if (r->count == 0)
+					buffer[count++] = r->character;
 			}
 		}
 	}
 
-	return ok;
+	if (count && !put_wide_chars(r, buffer, count)) return 0;
+
+	return len;
 }
 
 } // namespace impl
 
-static size_t format_uint_impl(FormatCallback callback, void* data, unsigned value, unsigned base)
+// Custom formatter of mf::Fixed aligns text itself so print_custom
+// doesn't add spaces: counted length is not less than width
+void formatter<Fixed>::format(FormatDst& dst, const FormatSpec& spec, const Fixed& value)
+{
+	if ((spec.format != 'f') && (spec.format != 0))
+	{
+		impl::put_text(dst, impl::error_text, sizeof(impl::error_text) - 1);
+		return;
+	}
+
+	FormatSpec fixed_spec = spec;
+	if (fixed_spec.align == 0)
+		fixed_spec.align = '>';
+
+	// no presentation and precision means shortest round-trip form
+	if ((fixed_spec.precision == -1) && (fixed_spec.format != 0))
+		fixed_spec.precision = 6;
+
+	impl::FormatCtx ctx{ dst, nullptr, { 0, nullptr }, 0 };
+	impl::print_fixed(ctx, fixed_spec, value);
+	dst.chars_printed = ctx.dst.chars_printed;
+	dst.is_full = ctx.dst.is_full;
+}
+
+static impl::DstData callback_dst(FormatCallback callback, void* data)
+{
+	return { callback, nullptr, data, 0 };
+}
+
+static impl::DstData buffer_dst(impl::FormatBufData& data)
+{
+	return { nullptr, impl::format_buf_block_callback, &data, 0 };
+}
+
+static size_t format_uint_impl(impl::DstData dst, unsigned value, unsigned base)
 {
-	impl::DstData dst{ callback, data, 0 };
 	impl::print_uint_impl(dst, value, base, false);
 	return dst.chars_printed;
 }
 
-size_t format_dec(FormatCallback callback, void* data, int value)
+static size_t format_int_impl(impl::DstData dst, int value)
 {
-	impl::DstData dst { callback, data, 0 };
 	if (value < 0)
 	{
 		value = -value;
@@ -883,18 +2230,23 @@ size_t format_dec(FormatCallback callback, void* data, int value)
 	return dst.chars_printed;
 }
 
+size_t format_dec(FormatCallback callback, void* data, int value)
+{
+	return format_int_impl(callback_dst(callback, data), value);
+}
+
 size_t format_dec(char* buffer, size_t buffer_size, int value)
 {
 	return impl::format_buf_impl(
 		buffer,
 		buffer_size,
-		[=](auto& data) { return format_dec(impl::format_buf_callback, &data, value); }
+		[=](auto& data) { return format_int_impl(buffer_dst(data), value); }
 	);
 }
 
 size_t format_dec(FormatCallback callback, void* data, unsigned value)
 {
-	return format_uint_impl(callback, data, value, 10);
+	return format_uint_impl(callback_dst(callback, data), value, 10);
 }
 
 size_t format_dec(char* buffer, size_t buffer_size, unsigned value)
@@ -902,13 +2254,13 @@ size_t format_dec(char* buffer, size_t buffer_size, unsigned value)
 	return impl::format_buf_impl(
 		buffer,
 		buffer_size,
-		[=](auto& data) { return format_dec(impl::format_buf_callback, &data, value); }
+		[=](auto& data) { return format_uint_impl(buffer_dst(data), value, 10); }
 	);
 }
 
 size_t format_hex(FormatCallback callback, void* data, unsigned value)
 {
-	return format_uint_impl(callback, data, value, 16);
+	return format_uint_impl(callback_dst(callback, data), value, 16);
 }
 
 size_t format_hex(char* buffer, size_t buffer_size, unsigned value)
@@ -916,13 +2268,13 @@ size_t format_hex(char* buffer, size_t buffer_size, unsigned value)
 	return impl::format_buf_impl(
 		buffer,
 		buffer_size,
-		[=](auto& data) { return format_hex(impl::format_buf_callback, &data, value); }
+		[=](auto& data) { return format_uint_impl(buffer_dst(data), value, 16); }
 	);
 }
 
 size_t format_bin(FormatCallback callback, void* data, unsigned value)
 {
-	return format_uint_impl(callback, data, value, 2);
+	return format_uint_impl(callback_dst(callback, data), value, 2);
 }
 
 size_t format_bin(char* buffer, size_t buffer_size, unsigned value)
@@ -930,15 +2282,14 @@ size_t format_bin(char* buffer, size_t buffer_size, unsigned value)
 	return impl::format_buf_impl(
 		buffer,
 		buffer_size,
-		[=](auto& data) { return format_bin(impl::format_buf_callback, &data, value); }
+		[=](auto& data) { return format_uint_impl(buffer_dst(data), value, 2); }
 	);
 }
 
 #if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
 
-size_t format_float(FormatCallback callback, void* cb_data, impl::FloatType value, int precision)
+static size_t format_float_impl(impl::DstData dst, impl::FloatType value, int precision)
 {
-	impl::DstData dst{ callback, cb_data, 0 };
 	impl::PrintFloatData data{};
 
 	impl::gather_data_to_print_float(value, precision, false, data);
@@ -953,12 +2304,17 @@ size_t format_float(FormatCallback callback, void* cb_data, impl::FloatType valu
 	return dst.chars_printed;
 }
 
+size_t format_float(FormatCallback callback, void* cb_data, impl::FloatType value, int precision)
+{
+	return format_float_impl(callback_dst(callback, cb_data), value, precision);
+}
+
 size_t format_float(char* buffer, size_t buffer_size, impl::FloatType value, int precision)
 {
 	return impl::format_buf_impl(
 		buffer,
 		buffer_size,
-		[=](auto& data) { return format_float(impl::format_buf_callback, &data, value, precision); }
+		[=](auto& data) { return format_float_impl(buffer_dst(data), value, precision); }
 	);
 }
 
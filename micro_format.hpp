@@ -27,6 +27,7 @@
 #pragma once
 
 #include <type_traits>
+#include <utility>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -35,7 +36,45 @@ namespace mf {
 using WideChar = uint32_t;
 
 using FormatCallback = bool (*)(void* data, char character);
+// Returns number of accepted characters. Formatting stops if it is less than len
+using FormatBlockCallback = size_t (*)(void* data, const char* text, size_t len);
 using FormatWideCallback = bool (*)(void* data, WideChar character);
+// Returns number of accepted characters. Formatting stops if it is less than len
+using FormatWideBlockCallback = size_t (*)(void* data, const WideChar* text, size_t len);
+
+// String argument with known length. Text may be not terminated by zero
+struct StrView
+{
+	const char* str;
+	size_t len;
+};
+
+inline StrView str_view(const char* str, size_t len)
+{
+	return { str, len };
+}
+
+// Fixed-point number raw / 2^frac_bits (Qm.n format with n = frac_bits).
+// It is printed by integer arithmetic only
+struct Fixed
+{
+	int32_t raw;
+	uint8_t frac_bits;
+};
+
+template <int FracBits>
+Fixed fixed(int32_t raw)
+{
+	static_assert((FracBits >= 0) && (FracBits < 32), "Wrong number of fractional bits");
+	return { raw, (uint8_t)FracBits };
+}
+
+// Specialization point for custom types. Specialization has static function
+//   static void format(mf::FormatDst& dst, const mf::FormatSpec& spec, const T& value)
+// which prints value by mf::format(dst, ...) or mf::put_text(dst, ...).
+// Text is aligned to width at left side if spec.align is 0
+template <typename T>
+struct formatter;
 
 namespace impl {
 
@@ -62,10 +101,49 @@ enum class FormatArgType : uint8_t
 	UInt,
 	Bool,
 	CharPtr,
+	StrView,
 	Pointer,
-	Float
+	Float,
+	SingleFloat,
+	Custom
 };
 
+struct DstData;
+struct FormatSpec;
+
+// Argument of custom type: pointer to value and function which prints it
+using CustomFormatFun = void (*)(DstData& dst, const FormatSpec& format_spec, const void* value);
+
+struct CustomArg
+{
+	const void* value;
+	CustomFormatFun format;
+};
+
+template <typename T, typename = void>
+struct HasFormatter : std::false_type {};
+
+template <typename T>
+struct HasFormatter<T, decltype((void)&formatter<T>::format)> : std::true_type {};
+
+template <typename T>
+void format_custom_arg(DstData& dst, const FormatSpec& format_spec, const void* value)
+{
+	formatter<T>::format(dst, format_spec, *(const T*)value);
+}
+
+template <typename T>
+auto to_str_view(const T& str) -> typename std::enable_if<
+	std::is_same<decltype(str.data()), const char*>::value &&
+	std::is_convertible<decltype(str.size()), size_t>::value,
+	StrView
+>::type
+{
+	return { str.data(), str.size() };
+}
+
+// Value of argument. Types of arguments are known at compile time
+// and passed separately packed into ArgTypesDesc
 struct FormatArg
 {
 	union
@@ -73,48 +151,625 @@ struct FormatArg
 		IntType i;
 		UIntType u;
 		uintptr_t p;
+		StrView str;
+		CustomArg custom;
 #if defined(MICRO_FORMAT_DOUBLE)
 		double f;
 #elif defined(MICRO_FORMAT_FLOAT)
 		float f;
 #endif
 	} value;
-	FormatArgType type = {};
-
-	FormatArg(char          v) : type(FormatArgType::Char) { value.i = v; }
-	FormatArg(unsigned char v) : type(FormatArgType::UChar) { value.u = v; }
-	FormatArg(int           v) : type(FormatArgType::Int) { value.i = v; }
-	FormatArg(unsigned      v) : type(FormatArgType::UInt) { value.u = v; }
-	FormatArg(IntType       v) : type(FormatArgType::Int) { value.i = v; }
-	FormatArg(UIntType      v) : type(FormatArgType::UInt) { value.u = v; }
-	FormatArg(bool          v) : type(FormatArgType::Bool) { value.u = v ? 1 : 0; }
-	FormatArg(const char*   v) : type(FormatArgType::CharPtr) { value.p = (uintptr_t)v; }
-	FormatArg(const void*   v) : type(FormatArgType::Pointer) { value.p = (uintptr_t)v; }
 
+	FormatArg(char          v) { value.i = v; }
+	FormatArg(unsigned char v) { value.u = v; }
+	FormatArg(int           v) { value.i = v; }
+	FormatArg(unsigned      v) { value.u = v; }
+	FormatArg(IntType       v) { value.i = v; }
+	FormatArg(UIntType      v) { value.u = v; }
+	FormatArg(bool          v) { value.u = v ? 1 : 0; }
+	FormatArg(const char*   v) { value.p = (uintptr_t)v; }
+	FormatArg(const void*   v) { value.p = (uintptr_t)v; }
+	FormatArg(StrView       v) { value.str = v; }
+
+	// std::string, std::string_view and other strings with data() and size()
+	template <typename T, typename = decltype(to_str_view(std::declval<const T&>()))>
+	FormatArg(const T& v) : FormatArg(to_str_view(v)) {}
+
+	// types with mf::formatter<T> specialization. Value is referenced, not copied
+	template <typename T, typename std::enable_if<HasFormatter<T>::value, int>::type = 0>
+	FormatArg(const T& v) { value.custom = { &v, format_custom_arg<T> }; }
+
+#if defined(MICRO_FORMAT_DOUBLE) || defined(MICRO_FORMAT_FLOAT)
+	FormatArg(float v) { value.f = v; }
+#endif
 #if defined(MICRO_FORMAT_DOUBLE)
-	FormatArg(double v) : type(FormatArgType::Float) { value.f = v; }
+	FormatArg(double v) { value.f = v; }
+#endif
+
+	FormatArg() { value.p = 0; }
+};
+
+// Types of arguments. Up to 16 types are packed by 4 bits (type of first
+// argument is in lowest bits), types of more arguments are passed as array
+struct ArgTypesDesc
+{
+	uint64_t packed;
+	const FormatArgType* types;
+};
+
+const int max_packed_args_count = 16;
+
+// Index of argument with width or precision is stored in int8_t
+const int max_dynamic_arg_index = 127;
+
+static_assert((int)FormatArgType::Custom < 16, "FormatArgType doesn't fit into 4 bits");
+
+constexpr FormatArgType unpack_arg_type(ArgTypesDesc arg_types, int index)
+{
+	return arg_types.types
+		? arg_types.types[index]
+		: (FormatArgType)((arg_types.packed >> (4 * index)) & 0xF);
+}
+
+constexpr uint64_t pack_arg_type(FormatArgType type, int index)
+{
+	return (uint64_t)type << (4 * index);
+}
+
+// Compile-time mapping of argument type to FormatArgType.
+// Overloads must be the same as constructors of FormatArg
+
+template <FormatArgType Type>
+using ArgTypeTag = std::integral_constant<FormatArgType, Type>;
+
+ArgTypeTag<FormatArgType::Char>    get_arg_type_tag(char);
+ArgTypeTag<FormatArgType::UChar>   get_arg_type_tag(unsigned char);
+ArgTypeTag<FormatArgType::Int>     get_arg_type_tag(int);
+ArgTypeTag<FormatArgType::UInt>    get_arg_type_tag(unsigned);
+ArgTypeTag<FormatArgType::Int>     get_arg_type_tag(IntType);
+ArgTypeTag<FormatArgType::UInt>    get_arg_type_tag(UIntType);
+ArgTypeTag<FormatArgType::Bool>    get_arg_type_tag(bool);
+ArgTypeTag<FormatArgType::CharPtr> get_arg_type_tag(const char*);
+ArgTypeTag<FormatArgType::Pointer> get_arg_type_tag(const void*);
+ArgTypeTag<FormatArgType::StrView> get_arg_type_tag(StrView);
+
+template <typename T, typename = decltype(to_str_view(std::declval<const T&>()))>
+ArgTypeTag<FormatArgType::StrView> get_arg_type_tag(const T&);
+
+template <typename T, typename std::enable_if<HasFormatter<T>::value, int>::type = 0>
+ArgTypeTag<FormatArgType::Custom> get_arg_type_tag(const T&);
+
+#if defined(MICRO_FORMAT_DOUBLE)
+ArgTypeTag<FormatArgType::Float> get_arg_type_tag(double);
+ArgTypeTag<FormatArgType::SingleFloat> get_arg_type_tag(float);
 #elif defined(MICRO_FORMAT_FLOAT)
-	FormatArg(float v) : type(FormatArgType::Float) { value.f = v; }
+ArgTypeTag<FormatArgType::Float> get_arg_type_tag(float);
+#endif
+
+template <typename T>
+constexpr FormatArgType get_arg_type()
+{
+	return decltype(get_arg_type_tag(std::declval<const T&>()))::value;
+}
+
+struct FormatSpec
+{
+	struct SpecFlags
+	{
+		uint8_t octothorp : 1;
+		uint8_t upper_case : 1;
+		uint8_t zero : 1;
+		uint8_t parsed_ok : 1;
+	};
+
+	int width = -1;
+	int precision = -1;
+	int length = -1;
+	int index = -1;
+	SpecFlags flags{};
+	char align = 0; // '<', '^', '>'
+	char fill = ' ';
+	int8_t width_index = -1;     // argument with width for "{:{}}"
+	int8_t precision_index = -1; // argument with precision for "{:.{}}"
+	char sign = 0;  // '+', '-', ' '
+	char format = 0;
+};
+
+constexpr bool is_integer_arg_type(FormatArgType arg_type)
+{
+	return
+		(arg_type == FormatArgType::Int) ||
+		(arg_type == FormatArgType::UInt);
+}
+
+constexpr bool is_float_arg_type(FormatArgType arg_type)
+{
+	return
+		(arg_type == FormatArgType::Float) ||
+		(arg_type == FormatArgType::SingleFloat);
+}
+
+constexpr bool is_char_arg_type(FormatArgType arg_type)
+{
+	return
+		(arg_type == FormatArgType::Char);
+}
+
+constexpr bool is_bool_arg_type(FormatArgType arg_type)
+{
+	return
+		(arg_type == FormatArgType::Bool);
+}
+
+constexpr bool is_str_arg_type(FormatArgType arg_type)
+{
+	return
+		(arg_type == FormatArgType::CharPtr) ||
+		(arg_type == FormatArgType::StrView);
+}
+
+// Parses replacement field after '{'. Returns pointer to text after '}' or
+// format_str if field is wrong (format_spec.flags.parsed_ok is not set in this case).
+// index is next automatic argument index. It is advanced for field and for
+// nested fields of width and precision
+constexpr const char* get_format_specifier(const char* format_str, FormatSpec& format_spec, int& index)
+{
+	enum class State : uint8_t
+	{
+		Undef,
+		IndexSpecified,
+		PtPassed,
+		PrecSpecified,
+		FormatSpecified,
+		Finished
+	};
+
+	State state = State::Undef;
+
+	const char* orig_format_str = format_str;
+
+	int* int_value = &format_spec.index;
+
+	for (;;)
+	{
+		unsigned char chr = (unsigned char)*format_str++;
+
+		if ((chr >= '0') && (chr <= '9'))
+		{
+			if ((state >= State::IndexSpecified) &&
+				(state < State::PtPassed) &&
+				(chr == '0') &&
+				int_value &&
+				(*int_value == -1))
+			{
+				format_spec.flags.zero = true;
+				continue;
+			}
+			else if (int_value)
+			{
+				if (*int_value == -1) *int_value = 0;
+				*int_value *= 10;
+				*int_value += chr - '0';
+				continue;
+			}
+			else
+				return orig_format_str;
+		}
+		else if (int_value && (*int_value != -1))
+			int_value = nullptr;
+
+		switch (chr)
+		{
+		case ':':
+			if (state == State::Undef)
+			{
+				int_value = &format_spec.width;
+				state = State::IndexSpecified;
+
+				// automatic index of field is before indexes of nested fields
+				if (format_spec.index == -1)
+					format_spec.index = index++;
+
+				// fill character before alignment: "{:*^20}"
+				unsigned char fill = (unsigned char)format_str[0];
+				char align = format_str[1];
+				bool is_align = (align == '<') || (align == '>') || (align == '^');
+				if (is_align && (fill >= ' ') && (fill < 0x80) && (fill != '{') && (fill != '}'))
+				{
+					format_spec.fill = fill;
+					format_spec.align = align;
+					format_str += 2;
+				}
+			}
+			else
+				return orig_format_str;
+			break;
+
+		case '.':
+			if ((state >= State::IndexSpecified) && (state < State::PtPassed))
+			{
+				int_value = &format_spec.precision;
+				state = State::PtPassed;
+			}
+			else
+				return orig_format_str;
+			break;
+
+		case '<': case '>': case '^':
+			if (format_spec.align == 0)
+				format_spec.align = chr;
+			else
+				return orig_format_str;
+			break;
+
+		case '+': case '-': case ' ':
+			if (format_spec.sign == 0)
+				format_spec.sign = chr;
+			else
+				return orig_format_str;
+			break;
+
+		case '#':
+			format_spec.flags.octothorp = true;
+			break;
+
+		case '{':
+		{
+			// width or precision from argument: "{}" or "{N}"
+			bool is_width =
+				(state == State::IndexSpecified) &&
+				(format_spec.width == -1) &&
+				(format_spec.width_index == -1);
+
+			bool is_precision =
+				(state == State::PtPassed) &&
+				(format_spec.precision == -1) &&
+				(format_spec.precision_index == -1);
+
+			if (!is_width && !is_precision)
+				return orig_format_str;
+
+			int arg_index = -1;
+			while ((*format_str >= '0') && (*format_str <= '9') && (arg_index <= max_dynamic_arg_index))
+			{
+				if (arg_index == -1) arg_index = 0;
+				arg_index = 10 * arg_index + (*format_str++ - '0');
+			}
+
+			if (*format_str++ != '}')
+				return orig_format_str;
+
+			if (arg_index == -1)
+				arg_index = index++;
+
+			if (arg_index > max_dynamic_arg_index)
+				return orig_format_str;
+
+			if (is_width)
+				format_spec.width_index = (int8_t)arg_index;
+			else
+				format_spec.precision_index = (int8_t)arg_index;
+
+			int_value = nullptr;
+			break;
+		}
+
+		case 'B': case 'b': case 'd':
+		case 'o': case 'x': case 'X':
+		case 'c': case 'f': case 'F':
+		case 'e': case 'E': case 'g': case 'G':
+		case 's': case 'p':
+			if (format_spec.format == 0)
+				format_spec.format = chr;
+			else
+				return orig_format_str;
+			state = State::FormatSpecified;
+			break;
+
+		case '}':
+			state = State::Finished;
+			break;
+
+		default:
+			return orig_format_str;
+		}
+
+		if (state == State::Finished) break;
+	}
+
+	auto user_format = format_spec.format;
+	switch (format_spec.format)
+	{
+	case 'F': format_spec.format = 'f'; break;
+	case 'E': format_spec.format = 'e'; break;
+	case 'G': format_spec.format = 'g'; break;
+	case 'X': format_spec.format = 'x'; break;
+	case 'B': format_spec.format = 'b'; break;
+	}
+	format_spec.flags.upper_case = (user_format != format_spec.format);
+
+	format_spec.flags.parsed_ok = true;
+
+	if (format_spec.index == -1)
+		format_spec.index = index++;
+
+	return format_str;
+}
+
+// Checks presentation of format_spec is suitable for argument type
+constexpr bool check_format_specifier(const FormatSpec& format_spec, FormatArgType type)
+{
+	auto f = format_spec.format;
+
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+	if (is_float_arg_type(type) && (f != 'f') && (f != 'e') && (f != 'g') && (f != 0))
+		return false;
+#else
+	if (is_float_arg_type(type) && (f != 'f') && (f != 0))
+		return false;
 #endif
 
-	FormatArg() : type(FormatArgType::Undef) { value.p = 0; }
+	bool is_integer_presentation =
+		(f == 'b') || (f == 'd') || (f == 'o') || (f == 'x');
+
+	if ((is_integer_arg_type(type) || is_char_arg_type(type)) &&
+	    !is_integer_presentation && (f != 'c') && (f != 0))
+		return false;
+
+	if (is_bool_arg_type(type) && !is_integer_presentation && (f != 's') && (f != 0))
+		return false;
+
+	if (is_str_arg_type(type) && (f != 's') && (f != 0))
+		return false;
+
+	return true;
+}
+
+// Sets default values of format_spec depending on argument type
+constexpr void correct_format_specifier(FormatSpec& format_spec, FormatArgType arg_type)
+{
+	if (format_spec.align == 0)
+	{
+		// custom formatter gets 0 and selects alignment itself
+		if (is_integer_arg_type(arg_type) || is_float_arg_type(arg_type))
+			format_spec.align = '>';
+		else if (arg_type != FormatArgType::Custom)
+			format_spec.align = '<';
+	}
+
+	switch (arg_type)
+	{
+	case FormatArgType::Pointer:
+		if ((format_spec.format == 0) || (format_spec.format == 'p'))
+		{
+			format_spec.format = 'p';
+			format_spec.flags.zero = true;
+			format_spec.flags.octothorp = true;
+
+			if (format_spec.width == -1)
+				format_spec.width = 2 * sizeof(void*) + (format_spec.flags.octothorp ? 2 : 0);
+		}
+		break;
+
+	case FormatArgType::Float:
+	case FormatArgType::SingleFloat:
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+		// no presentation and precision means shortest round-trip form
+		if ((format_spec.precision == -1) && (format_spec.format != 0))
+			format_spec.precision = 6;
+#else
+		if (format_spec.precision == -1)
+			format_spec.precision = 6;
+#endif
+		break;
+
+	default:
+		break;
+	}
+}
+
+// Part of format string: literal text and replacement field after it
+struct FormatSegment
+{
+	const char* text = nullptr;
+	size_t text_len = 0;
+	bool has_field = false;
+	FormatSpec spec{};
 };
 
+// Calls seg_fun for each segment of format string. Returns false if format string is wrong
+template <typename SegFun>
+constexpr bool for_each_format_segment(const char* format_str, const SegFun& seg_fun)
+{
+	int index = 0;
+	FormatSegment segment{};
+	segment.text = format_str;
+
+	for (;;)
+	{
+		char chr = *format_str++;
+		if (chr == 0) break;
+		if (chr != '{') continue;
+
+		if (*format_str == '{')
+		{
+			// "{{" -> first '{' ends literal text, second one is skipped
+			segment.text_len = format_str - segment.text;
+			seg_fun(segment);
+			format_str++;
+		}
+		else
+		{
+			segment.text_len = format_str - segment.text - 1;
+			segment.has_field = true;
+			format_str = get_format_specifier(format_str, segment.spec, index);
+			if (!segment.spec.flags.parsed_ok) return false;
+			seg_fun(segment);
+		}
+
+		segment = FormatSegment{};
+		segment.text = format_str;
+	}
+
+	segment.text_len = format_str - segment.text - 1;
+	seg_fun(segment);
+
+	return true;
+}
+
+struct SegmentsCounter
+{
+	size_t& count;
+	constexpr void operator () (const FormatSegment&) const { count++; }
+};
+
+constexpr size_t get_format_segments_count(const char* format_str)
+{
+	size_t count = 0;
+	for_each_format_segment(format_str, SegmentsCounter{count});
+	return count;
+}
+
+template <size_t Size>
+struct CompiledFormat
+{
+	FormatSegment segments[Size];
+	bool ok = false;
+};
+
+// Argument of width or precision must be integer
+constexpr bool check_dynamic_arg(int arg_index, const FormatArgType* arg_types, int args_count)
+{
+	return (arg_index == -1) || ((arg_index < args_count) && is_integer_arg_type(arg_types[arg_index]));
+}
+
+template <size_t Size>
+struct SegmentsCollector
+{
+	CompiledFormat<Size>& result;
+	const FormatArgType* arg_types;
+	int args_count;
+	size_t& pos;
+
+	constexpr void operator () (const FormatSegment& segment) const
+	{
+		auto& dst = result.segments[pos++];
+		dst = segment;
+
+		if (!dst.has_field) return;
+
+		if ((dst.spec.index >= args_count) ||
+		    !check_format_specifier(dst.spec, arg_types[dst.spec.index]) ||
+		    !check_dynamic_arg(dst.spec.width_index, arg_types, args_count) ||
+		    !check_dynamic_arg(dst.spec.precision_index, arg_types, args_count))
+			result.ok = false;
+		else
+			correct_format_specifier(dst.spec, arg_types[dst.spec.index]);
+	}
+};
+
+template <size_t Size>
+constexpr CompiledFormat<Size> compile_format(const char* format_str, const FormatArgType* arg_types, int args_count)
+{
+	CompiledFormat<Size> result{};
+	size_t pos = 0;
+	result.ok = true;
+	if (!for_each_format_segment(format_str, SegmentsCollector<Size>{result, arg_types, args_count, pos}))
+		result.ok = false;
+	return result;
+}
+
+constexpr ArgTypesDesc pack_arg_types(const FormatArgType* types, int count)
+{
+	if (count > max_packed_args_count)
+		return { 0, types };
+
+	ArgTypesDesc result = { 0, nullptr };
+	for (int i = 0; i < count; i++)
+		result.packed |= pack_arg_type(types[i], i);
+	return result;
+}
+
+template <typename ... Args>
+struct ArgTypes
+{
+	static constexpr FormatArgType types[(sizeof ... (Args)) ? (sizeof ... (Args)) : 1] = { get_arg_type<Args>() ... };
+	static constexpr ArgTypesDesc desc = pack_arg_types(types, sizeof ... (Args));
+};
+
+template <typename ... Args>
+constexpr FormatArgType ArgTypes<Args...>::types[];
+
+constexpr bool has_arg_type(ArgTypesDesc arg_types, int args_count, FormatArgType type)
+{
+	for (int i = 0; i < args_count; i++)
+		if (unpack_arg_type(arg_types, i) == type) return true;
+	return false;
+}
+
+template <typename ... Args>
+constexpr ArgTypesDesc ArgTypes<Args...>::desc;
+
+// Format string parsed and checked at compile time for given arguments types
+template <typename Str, typename ... Args>
+struct CompiledFormatFor
+{
+	static constexpr size_t size = get_format_segments_count(Str::get());
+
+	static constexpr CompiledFormat<size> format = compile_format<size>(
+		Str::get(),
+		ArgTypes<Args...>::types,
+		sizeof ... (Args)
+	);
+
+	static_assert(format.ok, "Wrong format string or type of argument");
+};
+
+template <typename Str, typename ... Args>
+constexpr CompiledFormat<CompiledFormatFor<Str, Args...>::size> CompiledFormatFor<Str, Args...>::format;
+
+// Format string wrapper created by MF_FMT macro
+template <typename Str>
+struct CompiledStr {};
+
+template <typename Str>
+constexpr CompiledStr<Str> make_compiled_str(Str)
+{
+	return {};
+}
+
+// Destination of formatting. If block_callback is set, text is passed to
+// it by blocks, else callback is called for each character
 struct DstData
 {
-	const FormatCallback callback;
-	void* const          data;
-	size_t               chars_printed;
+	const FormatCallback      callback;
+	const FormatBlockCallback block_callback;
+	void* const               data;
+	size_t                    chars_printed;
+	bool                      is_full = false; // block callback has refused text
+	bool                      utf8_width = false; // width and precision of strings are in code points
 };
 
 struct FormatCtx
 {
 	DstData dst;
 	const FormatArg* const args;
+	const ArgTypesDesc     arg_types;
 	const int              args_count;
 };
 
+void put_text(DstData& dst, const char* text, size_t len);
+
 void format_impl(FormatCtx& ctx, const char* format_str);
+void format_impl(FormatCtx& ctx, const FormatSegment* segments, size_t segments_count);
+
+// Parses format string at run time. Returns number of segments or 0 if
+// format string is wrong or has more than max_count segments
+size_t parse_format_segments(const char* format_str, FormatSegment* segments, size_t max_count);
+
+// Formats by segments parsed at run time. Arguments are checked before
+// printing and format_str is used if they don't match segments
+void format_impl(FormatCtx& ctx, const char* format_str, const FormatSegment* segments, size_t segments_count);
 
 // callback data for printing into string buffer
 struct FormatBufData
@@ -124,6 +779,7 @@ struct FormatBufData
 };
 
 bool format_buf_callback(void* data, char character);
+size_t format_buf_block_callback(void* data, const char* text, size_t len);
 
 template <typename PrintFun>
 size_t format_buf_impl(char* buffer, size_t buffer_size, const PrintFun &print_fun)
@@ -135,9 +791,11 @@ size_t format_buf_impl(char* buffer, size_t buffer_size, const PrintFun &print_f
 	return result;
 }
 
+// Decoder of utf8 text passed to wide callback or wide block callback
 struct Utf8Receiver
 {
 	FormatWideCallback cb = nullptr;
+	FormatWideBlockCallback block_cb = nullptr;
 	void* cb_data = nullptr;
 
 	WideChar character = 0;
@@ -146,7 +804,7 @@ struct Utf8Receiver
 	size_t chars_printed = 0;
 };
 
-bool utf8_char_callback(void* data, char chr);
+size_t utf8_block_callback(void* data, const char* text, size_t len);
 
 } // namespace impl
 
@@ -181,6 +839,13 @@ private:
 	size_t free_space_ = 0;
 };
 
+// Result of format_to_n
+struct FormatToNResult
+{
+	size_t printed; // characters stored into buffer without terminating zero
+	size_t size;    // characters of whole output like snprintf returns
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -190,20 +855,129 @@ size_t format(FormatCallback callback, void* data, const char* format_str, const
 {
 	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
 	const impl::FormatArg args_arr[arr_size] = { args ... };
-	impl::FormatCtx ctx{ { callback, data, 0 }, args_arr, sizeof ... (args) };
+	impl::FormatCtx ctx{ { callback, nullptr, data, 0 }, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
 	impl::format_impl(ctx, format_str);
 	return ctx.dst.chars_printed;
 }
 
+// Print values formating by {} syntax calling callback for each character.
+// Format string is created by MF_FMT macro and parsed at compile time
+template <typename Str, typename ... Args>
+size_t format(FormatCallback callback, void* data, impl::CompiledStr<Str>, const Args& ... args)
+{
+	using Compiled = impl::CompiledFormatFor<Str, Args...>;
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const impl::FormatArg args_arr[arr_size] = { args ... };
+	impl::FormatCtx ctx{ { callback, nullptr, data, 0 }, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+	impl::format_impl(ctx, Compiled::format.segments, Compiled::size);
+	return ctx.dst.chars_printed;
+}
+
+// Print values formating by {} syntax passing text to callback by blocks
+template <typename ... Args>
+size_t format(FormatBlockCallback callback, void* data, const char* format_str, const Args& ... args)
+{
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const impl::FormatArg args_arr[arr_size] = { args ... };
+	impl::FormatCtx ctx{ { nullptr, callback, data, 0 }, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+	impl::format_impl(ctx, format_str);
+	return ctx.dst.chars_printed;
+}
+
+// Print values formating by compile-time parsed format string passing text to callback by blocks
+template <typename Str, typename ... Args>
+size_t format(FormatBlockCallback callback, void* data, impl::CompiledStr<Str>, const Args& ... args)
+{
+	using Compiled = impl::CompiledFormatFor<Str, Args...>;
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const impl::FormatArg args_arr[arr_size] = { args ... };
+	impl::FormatCtx ctx{ { nullptr, callback, data, 0 }, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+	impl::format_impl(ctx, Compiled::format.segments, Compiled::size);
+	return ctx.dst.chars_printed;
+}
+
+// Returns number of characters which format prints for the same arguments.
+// Nothing is printed and digits of integers are not generated
+template <typename ... Args>
+size_t formatted_size(const char* format_str, const Args& ... args)
+{
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const impl::FormatArg args_arr[arr_size] = { args ... };
+	impl::FormatCtx ctx{ { nullptr, nullptr, nullptr, 0 }, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+	impl::format_impl(ctx, format_str);
+	return ctx.dst.chars_printed;
+}
+
+// Returns number of characters for compile-time parsed format string
+template <typename Str, typename ... Args>
+size_t formatted_size(impl::CompiledStr<Str>, const Args& ... args)
+{
+	using Compiled = impl::CompiledFormatFor<Str, Args...>;
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const impl::FormatArg args_arr[arr_size] = { args ... };
+	impl::FormatCtx ctx{ { nullptr, nullptr, nullptr, 0 }, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+	impl::format_impl(ctx, Compiled::format.segments, Compiled::size);
+	return ctx.dst.chars_printed;
+}
+
+namespace impl {
+
+// Width and precision of strings are counted in code points for utf8 text
+template <typename ... Args>
+size_t format_u8_impl(Utf8Receiver& utf8, const char* format_str_utf8, const Args& ... args)
+{
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const FormatArg args_arr[arr_size] = { args ... };
+	FormatCtx ctx{ { nullptr, utf8_block_callback, &utf8, 0, false, true }, args_arr, ArgTypes<Args...>::desc, sizeof ... (args) };
+	format_impl(ctx, format_str_utf8);
+	return utf8.chars_printed;
+}
+
+template <typename Str, typename ... Args>
+size_t format_u8_impl(Utf8Receiver& utf8, CompiledStr<Str>, const Args& ... args)
+{
+	using Compiled = CompiledFormatFor<Str, Args...>;
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const FormatArg args_arr[arr_size] = { args ... };
+	FormatCtx ctx{ { nullptr, utf8_block_callback, &utf8, 0, false, true }, args_arr, ArgTypes<Args...>::desc, sizeof ... (args) };
+	format_impl(ctx, Compiled::format.segments, Compiled::size);
+	return utf8.chars_printed;
+}
+
+} // namespace impl
+
 // Print values formating by {} syntax calling callback for each wide character
 // format_str and string arguments must be in utf8 enconding
 // Return value is number of wide chars printed in function
 template <typename ... Args>
 size_t format_u8(FormatWideCallback callback, void* data, const char* format_str_utf8, const Args& ... args)
 {
-	impl::Utf8Receiver utf8 = { callback, data, 0, 0, '?', 0 };
-	format(impl::utf8_char_callback, &utf8, format_str_utf8, args...);
-	return utf8.chars_printed;
+	impl::Utf8Receiver utf8 = { callback, nullptr, data, 0, 0, '?', 0 };
+	return impl::format_u8_impl(utf8, format_str_utf8, args...);
+}
+
+// Print values formating by compile-time parsed format string calling callback for each wide character
+template <typename Str, typename ... Args>
+size_t format_u8(FormatWideCallback callback, void* data, impl::CompiledStr<Str> format_str_utf8, const Args& ... args)
+{
+	impl::Utf8Receiver utf8 = { callback, nullptr, data, 0, 0, '?', 0 };
+	return impl::format_u8_impl(utf8, format_str_utf8, args...);
+}
+
+// Print values formating by {} syntax passing wide characters to callback by blocks
+template <typename ... Args>
+size_t format_u8(FormatWideBlockCallback callback, void* data, const char* format_str_utf8, const Args& ... args)
+{
+	impl::Utf8Receiver utf8 = { nullptr, callback, data, 0, 0, '?', 0 };
+	return impl::format_u8_impl(utf8, format_str_utf8, args...);
+}
+
+// Print values formating by compile-time parsed format string passing wide characters to callback by blocks
+template <typename Str, typename ... Args>
+size_t format_u8(FormatWideBlockCallback callback, void* data, impl::CompiledStr<Str> format_str_utf8, const Args& ... args)
+{
+	impl::Utf8Receiver utf8 = { nullptr, callback, data, 0, 0, '?', 0 };
+	return impl::format_u8_impl(utf8, format_str_utf8, args...);
 }
 
 // Print values formating by {} syntax into buffer
@@ -213,7 +987,7 @@ size_t format(char* buffer, size_t buffer_size, const char* format_str, const Ar
 	return impl::format_buf_impl(
 		buffer,
 		buffer_size,
-		[&](auto& data) { return format(impl::format_buf_callback, &data, format_str, args...); }
+		[&](auto& data) { return format(impl::format_buf_block_callback, &data, format_str, args...); }
 	);
 }
 
@@ -224,6 +998,24 @@ size_t format(char (&buffer)[BufSize], const char* format_str, const Args& ... a
 	return format(buffer, BufSize, format_str, args...);
 }
 
+// Print values formating by compile-time parsed format string into buffer
+template <typename Str, typename ... Args>
+size_t format(char* buffer, size_t buffer_size, impl::CompiledStr<Str> format_str, const Args& ... args)
+{
+	return impl::format_buf_impl(
+		buffer,
+		buffer_size,
+		[&](auto& data) { return format(impl::format_buf_block_callback, &data, format_str, args...); }
+	);
+}
+
+// Print values formating by compile-time parsed format string into constant-sized buffer
+template <typename Str, typename ... Args, size_t BufSize>
+size_t format(char (&buffer)[BufSize], impl::CompiledStr<Str> format_str, const Args& ... args)
+{
+	return format(buffer, BufSize, format_str, args...);
+}
+
 // Append text into buffer
 template <typename ... Args>
 size_t format(BufferPrinter &buf_printer, const char* format_str, const Args& ... args)
@@ -231,7 +1023,22 @@ size_t format(BufferPrinter &buf_printer, const char* format_str, const Args& ..
 	size_t size = impl::format_buf_impl(
 		buf_printer.get_buf(),
 		buf_printer.get_free_buf_space(),
-		[&](auto& data) { return format(impl::format_buf_callback, &data, format_str, args...); }
+		[&](auto& data) { return format(impl::format_buf_block_callback, &data, format_str, args...); }
+	);
+
+	buf_printer.reduce(size);
+
+	return size;
+}
+
+// Append text into buffer using compile-time parsed format string
+template <typename Str, typename ... Args>
+size_t format(BufferPrinter &buf_printer, impl::CompiledStr<Str> format_str, const Args& ... args)
+{
+	size_t size = impl::format_buf_impl(
+		buf_printer.get_buf(),
+		buf_printer.get_free_buf_space(),
+		[&](auto& data) { return format(impl::format_buf_block_callback, &data, format_str, args...); }
 	);
 
 	buf_printer.reduce(size);
@@ -239,6 +1046,227 @@ size_t format(BufferPrinter &buf_printer, const char* format_str, const Args& ..
 	return size;
 }
 
+// Print values formating by {} syntax into buffer. Formatting stops when buffer
+// is full and length of whole output is computed without printing
+template <typename ... Args>
+FormatToNResult format_to_n(char* buffer, size_t buffer_size, const char* format_str, const Args& ... args)
+{
+	FormatToNResult result;
+	result.printed = format(buffer, buffer_size, format_str, args...);
+	result.size = (result.printed + 1 < buffer_size) ? result.printed : formatted_size(format_str, args...);
+	return result;
+}
+
+// Print values formating by {} syntax into constant-sized buffer. Returns also length of whole output
+template <typename ... Args, size_t BufSize>
+FormatToNResult format_to_n(char (&buffer)[BufSize], const char* format_str, const Args& ... args)
+{
+	return format_to_n(buffer, BufSize, format_str, args...);
+}
+
+// Print values formating by compile-time parsed format string into buffer. Returns also length of whole output
+template <typename Str, typename ... Args>
+FormatToNResult format_to_n(char* buffer, size_t buffer_size, impl::CompiledStr<Str> format_str, const Args& ... args)
+{
+	FormatToNResult result;
+	result.printed = format(buffer, buffer_size, format_str, args...);
+	result.size = (result.printed + 1 < buffer_size) ? result.printed : formatted_size(format_str, args...);
+	return result;
+}
+
+// Print values formating by compile-time parsed format string into constant-sized buffer
+template <typename Str, typename ... Args, size_t BufSize>
+FormatToNResult format_to_n(char (&buffer)[BufSize], impl::CompiledStr<Str> format_str, const Args& ... args)
+{
+	return format_to_n(buffer, BufSize, format_str, args...);
+}
+
+// Destination and format specifier passed to mf::formatter<T>::format
+using FormatDst = impl::DstData;
+using FormatSpec = impl::FormatSpec;
+
+// Fixed-point numbers are printed by custom formatter. It is linked only if it is used
+template <>
+struct formatter<Fixed>
+{
+	static void format(FormatDst& dst, const FormatSpec& spec, const Fixed& value);
+};
+
+// Puts text into destination of custom formatter
+inline void put_text(FormatDst& dst, const char* text, size_t len)
+{
+	impl::put_text(dst, text, len);
+}
+
+// Print values formating by {} syntax into destination of custom formatter
+template <typename ... Args>
+size_t format(FormatDst& dst, const char* format_str, const Args& ... args)
+{
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const impl::FormatArg args_arr[arr_size] = { args ... };
+	impl::FormatCtx ctx{ dst, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+	impl::format_impl(ctx, format_str);
+	dst.chars_printed += ctx.dst.chars_printed;
+	dst.is_full = ctx.dst.is_full;
+	return ctx.dst.chars_printed;
+}
+
+// Print values formating by compile-time parsed format string into destination of custom formatter
+template <typename Str, typename ... Args>
+size_t format(FormatDst& dst, impl::CompiledStr<Str>, const Args& ... args)
+{
+	using Compiled = impl::CompiledFormatFor<Str, Args...>;
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const impl::FormatArg args_arr[arr_size] = { args ... };
+	impl::FormatCtx ctx{ dst, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+	impl::format_impl(ctx, Compiled::format.segments, Compiled::size);
+	dst.chars_printed += ctx.dst.chars_printed;
+	dst.is_full = ctx.dst.is_full;
+	return ctx.dst.chars_printed;
+}
+
+namespace impl {
+
+// Format of element of range parsed once for all elements:
+// text before field, field, text after field and separator
+struct RangeFormat
+{
+	const char* prefix;
+	size_t      prefix_len;
+	FormatSpec  spec;
+	const char* suffix;
+	size_t      suffix_len;
+	const char* separator;
+	size_t      separator_len;
+};
+
+// Returns false and prints error if format_str hasn't exactly one field
+bool parse_range_format(FormatCtx& ctx, const char* format_str, const char* separator, RangeFormat& result);
+
+void print_range_value(FormatCtx& ctx, const RangeFormat& range, size_t index, IntType value);
+void print_range_value(FormatCtx& ctx, const RangeFormat& range, size_t index, UIntType value);
+#if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
+void print_range_value(FormatCtx& ctx, const RangeFormat& range, size_t index, FloatType value, bool is_single);
+#endif
+
+// Elements of range are numbers. Characters (uint8_t too) are printed as integers
+template <typename T>
+constexpr FormatArgType get_range_arg_type()
+{
+	static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, "Element of range must be number");
+	static_assert(std::is_floating_point<T>::value || (sizeof(T) <= sizeof(IntType)), "Integer is too long. Define MICRO_FORMAT_INT64");
+#if !defined (MICRO_FORMAT_DOUBLE) && !defined (MICRO_FORMAT_FLOAT)
+	static_assert(!std::is_floating_point<T>::value, "Define MICRO_FORMAT_DOUBLE or MICRO_FORMAT_FLOAT");
+#endif
+	return
+#if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
+		std::is_floating_point<T>::value ? ((sizeof(T) < sizeof(FloatType)) ? FormatArgType::SingleFloat : FormatArgType::Float) :
+#endif
+		std::is_signed<T>::value ? FormatArgType::Int :
+		FormatArgType::UInt;
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+print_range_element(FormatCtx& ctx, const RangeFormat& range, size_t index, T value)
+{
+	print_range_value(ctx, range, index, (IntType)value);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+print_range_element(FormatCtx& ctx, const RangeFormat& range, size_t index, T value)
+{
+	print_range_value(ctx, range, index, (UIntType)value);
+}
+
+#if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+print_range_element(FormatCtx& ctx, const RangeFormat& range, size_t index, T value)
+{
+	print_range_value(ctx, range, index, (FloatType)value, get_range_arg_type<T>() == FormatArgType::SingleFloat);
+}
+#endif
+
+template <typename T>
+size_t format_range_impl(DstData dst, const char* format_str, const T* values, size_t count, const char* separator)
+{
+	const FormatArg arg;
+	FormatCtx ctx{ dst, &arg, { pack_arg_type(get_range_arg_type<T>(), 0), nullptr }, 1 };
+	ctx.dst.chars_printed = 0;
+
+	RangeFormat range;
+	if (!parse_range_format(ctx, format_str, separator, range))
+		return ctx.dst.chars_printed;
+
+	for (size_t i = 0; (i < count) && !ctx.dst.is_full; i++)
+		print_range_element(ctx, range, i, values[i]);
+
+	return ctx.dst.chars_printed;
+}
+
+} // namespace impl
+
+// Print each number of array formating by format_str with one field ("{:6.2}")
+// and separator between numbers. format_str is parsed once for all numbers.
+// Callback is called for each character
+template <typename T>
+size_t format_range(FormatCallback callback, void* data, const char* format_str, const T* values, size_t count, const char* separator = ", ")
+{
+	return impl::format_range_impl({ callback, nullptr, data, 0 }, format_str, values, count, separator);
+}
+
+// Print each number of array passing text to callback by blocks
+template <typename T>
+size_t format_range(FormatBlockCallback callback, void* data, const char* format_str, const T* values, size_t count, const char* separator = ", ")
+{
+	return impl::format_range_impl({ nullptr, callback, data, 0 }, format_str, values, count, separator);
+}
+
+// Print each number of array into buffer
+template <typename T>
+size_t format_range(char* buffer, size_t buffer_size, const char* format_str, const T* values, size_t count, const char* separator = ", ")
+{
+	return impl::format_buf_impl(
+		buffer,
+		buffer_size,
+		[&](auto& data) { return format_range(impl::format_buf_block_callback, &data, format_str, values, count, separator); }
+	);
+}
+
+// Print each number of array into constant-sized buffer
+template <typename T, size_t BufSize>
+size_t format_range(char (&buffer)[BufSize], const char* format_str, const T* values, size_t count, const char* separator = ", ")
+{
+	return format_range(buffer, BufSize, format_str, values, count, separator);
+}
+
+// Print each number of container with data() and size() (std::vector, std::array, std::span)
+template <typename Range, typename = decltype(std::declval<const Range&>().data() + std::declval<const Range&>().size())>
+size_t format_range(FormatCallback callback, void* data, const char* format_str, const Range& range, const char* separator = ", ")
+{
+	return format_range(callback, data, format_str, range.data(), range.size(), separator);
+}
+
+template <typename Range, typename = decltype(std::declval<const Range&>().data() + std::declval<const Range&>().size())>
+size_t format_range(FormatBlockCallback callback, void* data, const char* format_str, const Range& range, const char* separator = ", ")
+{
+	return format_range(callback, data, format_str, range.data(), range.size(), separator);
+}
+
+template <typename Range, typename = decltype(std::declval<const Range&>().data() + std::declval<const Range&>().size())>
+size_t format_range(char* buffer, size_t buffer_size, const char* format_str, const Range& range, const char* separator = ", ")
+{
+	return format_range(buffer, buffer_size, format_str, range.data(), range.size(), separator);
+}
+
+template <typename Range, size_t BufSize, typename = decltype(std::declval<const Range&>().data() + std::declval<const Range&>().size())>
+size_t format_range(char (&buffer)[BufSize], const char* format_str, const Range& range, const char* separator = ", ")
+{
+	return format_range(buffer, BufSize, format_str, range.data(), range.size(), separator);
+}
+
 // Print integer as decimal value calling callback for each character
 size_t format_dec(FormatCallback callback, void* data, int value);
 
@@ -310,3 +1338,12 @@ size_t format_float(char(&buffer)[BufSize], impl::FloatType value, int precision
 
 } // namespace mf
 
+// Makes format string which is parsed and checked at compile time:
+// mf::format(buffer, MF_FMT("U={:8.2}v"), voltage);
+// Wrong replacement fields and wrong argument types cause compilation error
+#define MF_FMT(str) \
+	(mf::impl::make_compiled_str([] { \
+		struct Str { static constexpr const char* get() { return str; } }; \
+		return Str{}; \
+	}()))
+
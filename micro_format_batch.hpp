@@ -0,0 +1,129 @@
+/* C++ library for std::format-like text formating for microcontrollers
+   https://github.com/art-den/micro_format
+
+   MIT License
+
+   Copyright (c) 2020-2021 Artyomov Denis (denis.artyomov@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#pragma once
+
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "micro_format.hpp"
+
+namespace mf {
+
+namespace impl {
+
+template <typename FormatStr, typename Tuple, size_t ... Indexes>
+size_t formatted_tuple_size(FormatStr format_str, const Tuple& args, std::index_sequence<Indexes...>)
+{
+	return formatted_size(format_str, std::get<Indexes>(args)...);
+}
+
+template <typename FormatStr, typename Tuple, size_t ... Indexes>
+size_t format_tuple(FormatBufData& data, FormatStr format_str, const Tuple& args, std::index_sequence<Indexes...>)
+{
+	return format(format_buf_block_callback, &data, format_str, std::get<Indexes>(args)...);
+}
+
+// Calls fun(part, begin, end) for each part of [0, count) in own thread.
+// The last part is processed in calling thread
+template <typename Fun>
+void run_batch_parts(size_t count, size_t parts_count, const Fun& fun)
+{
+	std::vector<std::thread> threads;
+	threads.reserve(parts_count - 1);
+
+	for (size_t part = 0; part < parts_count; part++)
+	{
+		size_t begin = count * part / parts_count;
+		size_t end = count * (part + 1) / parts_count;
+		if (part == parts_count - 1)
+			fun(part, begin, end);
+		else
+			threads.emplace_back(fun, part, begin, end);
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+} // namespace impl
+
+// Formats each record (tuple of arguments) by format_str and appends texts of
+// records one after another to text. Each thread computes size of its part of
+// records, then formats them directly into their place of text. threads_count
+// is limited so each thread gets not less than min_records_per_thread records.
+// 0 means std::thread::hardware_concurrency(). Returns number of characters added
+template <typename FormatStr, typename ... Args>
+size_t format_batch(
+	std::string& text,
+	FormatStr format_str,
+	const std::tuple<Args...>* records,
+	size_t count,
+	unsigned threads_count = 0)
+{
+	const size_t min_records_per_thread = 4096;
+	using Indexes = std::index_sequence_for<Args...>;
+
+	if (threads_count == 0) threads_count = std::thread::hardware_concurrency();
+	size_t parts_count = count / min_records_per_thread;
+	if (parts_count > threads_count) parts_count = threads_count;
+	if (parts_count == 0) parts_count = 1;
+
+	std::vector<size_t> offsets(parts_count + 1);
+
+	impl::run_batch_parts(count, parts_count, [&](size_t part, size_t begin, size_t end) {
+		size_t size = 0;
+		for (size_t i = begin; i < end; i++)
+			size += impl::formatted_tuple_size(format_str, records[i], Indexes());
+		offsets[part + 1] = size;
+	});
+
+	offsets[0] = text.size();
+	for (size_t part = 0; part < parts_count; part++)
+		offsets[part + 1] += offsets[part];
+
+	text.resize(offsets[parts_count]);
+	char* buffer = &text[0];
+
+	impl::run_batch_parts(count, parts_count, [&](size_t part, size_t begin, size_t end) {
+		impl::FormatBufData data = { buffer + offsets[part], offsets[part + 1] - offsets[part] };
+		for (size_t i = begin; i < end; i++)
+			impl::format_tuple(data, format_str, records[i], Indexes());
+	});
+
+	return offsets[parts_count] - offsets[0];
+}
+
+// The same for vector of records
+template <typename FormatStr, typename ... Args>
+size_t format_batch(std::string& text, FormatStr format_str, const std::vector<std::tuple<Args...>>& records, unsigned threads_count = 0)
+{
+	return format_batch(text, format_str, records.data(), records.size(), threads_count);
+}
+
+} // namespace mf
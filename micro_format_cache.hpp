@@ -0,0 +1,224 @@
+/* C++ library for std::format-like text formating for microcontrollers
+   https://github.com/art-den/micro_format
+
+   MIT License
+
+   Copyright (c) 2020-2021 Artyomov Denis (denis.artyomov@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+#pragma once
+
+#include <atomic>
+#include <string.h>
+#include <type_traits>
+#include "micro_format.hpp"
+
+namespace mf {
+
+// Cache of format strings parsed at run time (strings from configuration
+// tables etc.). Key is pointer to format string so content of string must not
+// be changed while it is in cache. Entry is selected by hash of pointer and
+// is replaced on miss. Format strings with more than MaxSegments segments
+// (literal text and replacement field after it) are not cached and don't
+// replace entry. Last of them is remembered to format it without parsing twice.
+// ThreadSafe version never waits: string is parsed without cache if entry is
+// used by other thread or interrupt handler
+template <size_t EntriesCount = 8, size_t MaxSegments = 8, bool ThreadSafe = false>
+class FormatCache
+{
+	static_assert(EntriesCount != 0, "EntriesCount must not be zero");
+
+public:
+	FormatCache() = default;
+	FormatCache(const FormatCache&) = delete;
+	FormatCache& operator = (const FormatCache&) = delete;
+
+	// Print values formating by {} syntax calling callback for each character
+	template <typename ... Args>
+	size_t format(FormatCallback callback, void* data, const char* format_str, const Args& ... args)
+	{
+		constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+		const impl::FormatArg args_arr[arr_size] = { args ... };
+		impl::FormatCtx ctx{ { callback, nullptr, data, 0 }, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+		format_impl(ctx, format_str, SyncTag());
+		return ctx.dst.chars_printed;
+	}
+
+	// Print values formating by {} syntax passing text to callback by blocks
+	template <typename ... Args>
+	size_t format(FormatBlockCallback callback, void* data, const char* format_str, const Args& ... args)
+	{
+		constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+		const impl::FormatArg args_arr[arr_size] = { args ... };
+		impl::FormatCtx ctx{ { nullptr, callback, data, 0 }, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args) };
+		format_impl(ctx, format_str, SyncTag());
+		return ctx.dst.chars_printed;
+	}
+
+	// Print values formating by {} syntax into buffer
+	template <typename ... Args>
+	size_t format(char* buffer, size_t buffer_size, const char* format_str, const Args& ... args)
+	{
+		return impl::format_buf_impl(
+			buffer,
+			buffer_size,
+			[&](auto& data) { return format(impl::format_buf_block_callback, &data, format_str, args...); }
+		);
+	}
+
+	// Print values formating by {} syntax into constant-sized buffer
+	template <typename ... Args, size_t BufSize>
+	size_t format(char (&buffer)[BufSize], const char* format_str, const Args& ... args)
+	{
+		return format(buffer, BufSize, format_str, args...);
+	}
+
+	// Number of format calls which used parsed segments from cache
+	uint32_t get_hits_count() const { return hits_; }
+
+	// Number of format calls which parsed format string
+	uint32_t get_misses_count() const { return misses_; }
+
+	// Removes all entries. Must not be called while cache is used by other threads
+	void clear()
+	{
+		for (auto& entry : entries_)
+		{
+			entry.format_str = nullptr;
+			entry.uncached_str = nullptr;
+		}
+		hits_ = 0;
+		misses_ = 0;
+	}
+
+private:
+	using SyncTag = std::integral_constant<bool, ThreadSafe>;
+	using Counter = typename std::conditional<ThreadSafe, std::atomic<uint32_t>, uint32_t>::type;
+
+	struct Entry
+	{
+		const char* format_str = nullptr;
+		const char* uncached_str = nullptr; // string which doesn't fit into entry
+		size_t segments_count = 0;
+		impl::FormatSegment segments[MaxSegments];
+	};
+
+	struct SyncEntry : Entry
+	{
+		std::atomic_flag busy = ATOMIC_FLAG_INIT;
+	};
+
+	typename std::conditional<ThreadSafe, SyncEntry, Entry>::type entries_[EntriesCount];
+	Counter hits_ { 0 };
+	Counter misses_ { 0 };
+
+	static size_t get_entry_index(const char* format_str)
+	{
+		uint32_t hash = (uint32_t)(uintptr_t)format_str * 2654435761UL;
+		return (hash >> 16) % EntriesCount;
+	}
+
+	// Parses format string into segments and stores them into entry if they
+	// fit. Otherwise entry is kept and string is remembered as uncached
+	static size_t parse_to_entry(Entry& entry, const char* format_str, impl::FormatSegment* segments)
+	{
+		size_t segments_count = impl::parse_format_segments(format_str, segments, MaxSegments);
+
+		if (segments_count)
+		{
+			entry.format_str = format_str;
+			entry.segments_count = segments_count;
+			memcpy(entry.segments, segments, sizeof(impl::FormatSegment) * segments_count);
+		}
+		else
+			entry.uncached_str = format_str;
+
+		return segments_count;
+	}
+
+	void format_impl(impl::FormatCtx& ctx, const char* format_str, std::false_type)
+	{
+		Entry& entry = entries_[get_entry_index(format_str)];
+
+		if (entry.format_str == format_str)
+		{
+			hits_++;
+			impl::format_impl(ctx, format_str, entry.segments, entry.segments_count);
+			return;
+		}
+
+		misses_++;
+
+		if (entry.uncached_str != format_str)
+		{
+			impl::FormatSegment segments[MaxSegments];
+			size_t segments_count = parse_to_entry(entry, format_str, segments);
+			if (segments_count)
+			{
+				impl::format_impl(ctx, format_str, segments, segments_count);
+				return;
+			}
+		}
+
+		impl::format_impl(ctx, format_str);
+	}
+
+	// Segments are copied from entry so it is locked only for short time
+	void format_impl(impl::FormatCtx& ctx, const char* format_str, std::true_type)
+	{
+		SyncEntry& entry = entries_[get_entry_index(format_str)];
+		impl::FormatSegment segments[MaxSegments];
+		size_t segments_count = 0;
+
+		if (!entry.busy.test_and_set(std::memory_order_acquire))
+		{
+			if (entry.format_str == format_str)
+			{
+				hits_++;
+				segments_count = entry.segments_count;
+				memcpy(segments, entry.segments, sizeof(impl::FormatSegment) * segments_count);
+			}
+			else
+			{
+				misses_++;
+				if (entry.uncached_str != format_str)
+					segments_count = parse_to_entry(entry, format_str, segments);
+			}
+
+			entry.busy.clear(std::memory_order_release);
+		}
+		else
+		{
+			misses_++;
+			segments_count = impl::parse_format_segments(format_str, segments, MaxSegments);
+		}
+
+		if (segments_count)
+			impl::format_impl(ctx, format_str, segments, segments_count);
+		else
+			impl::format_impl(ctx, format_str);
+	}
+};
+
+// Format cache which may be used by many threads and interrupt handlers
+template <size_t EntriesCount = 8, size_t MaxSegments = 8>
+using SyncFormatCache = FormatCache<EntriesCount, MaxSegments, true>;
+
+} // namespace mf
@@ -0,0 +1,326 @@
+/* C++ library for std::format-like text formating for microcontrollers
+   https://github.com/art-den/micro_format
+
+   MIT License
+
+   Copyright (c) 2020-2021 Artyomov Denis (denis.artyomov@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#include <string.h>
+#include "micro_format_id.hpp"
+
+namespace mf {
+namespace impl {
+
+#if defined (__GNUC__) && defined (__ELF__)
+
+// Start of "mf_fmt" section created by linker
+extern "C" __attribute__((weak)) const char __start_mf_fmt[];
+
+uint32_t get_format_id(const char* format_str)
+{
+	return (uint32_t)(format_str - __start_mf_fmt);
+}
+
+#else
+
+uint32_t get_format_id(const char* format_str)
+{
+	return (uint32_t)(uintptr_t)format_str;
+}
+
+#endif
+
+static int write_varint(uint8_t* buf, uint64_t value)
+{
+	int len = 0;
+	while (value >= 0x80)
+	{
+		buf[len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (uint8_t)value;
+	return len;
+}
+
+static bool read_varint(const uint8_t*& ptr, const uint8_t* end, uint64_t& value)
+{
+	value = 0;
+	for (int shift = 0; (ptr != end) && (shift < 64); shift += 7)
+	{
+		uint8_t byte = *ptr++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+#if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
+static int write_le(uint8_t* buf, uint64_t value, int size)
+{
+	for (int i = 0; i < size; i++)
+		buf[i] = (uint8_t)(value >> (8 * i));
+	return size;
+}
+#endif
+
+static uint64_t read_le(const uint8_t* ptr, int size)
+{
+	uint64_t result = 0;
+	for (int i = 0; i < size; i++)
+		result |= (uint64_t)ptr[i] << (8 * i);
+	return result;
+}
+
+static const char* get_arg_str(const FormatArg& arg)
+{
+	auto* str = (const char*)arg.value.p;
+	return str ? str : "";
+}
+
+// Writes type and value of argument into buf. Characters of string are not written
+static int encode_arg(const FormatArg& arg, FormatArgType type, uint8_t* buf)
+{
+	int len = 0;
+	buf[len++] = (uint8_t)type;
+
+	switch (type)
+	{
+	case FormatArgType::Char:
+		buf[len++] = (uint8_t)arg.value.i;
+		break;
+
+	case FormatArgType::UChar:
+	case FormatArgType::Bool:
+		buf[len++] = (uint8_t)arg.value.u;
+		break;
+
+	case FormatArgType::Int:
+	{
+		int64_t value = arg.value.i;
+		len += write_varint(buf + len, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+		break;
+	}
+
+	case FormatArgType::UInt:
+		len += write_varint(buf + len, arg.value.u);
+		break;
+
+	case FormatArgType::Pointer:
+		len += write_varint(buf + len, arg.value.p);
+		break;
+
+	case FormatArgType::StrView:
+		len += write_varint(buf + len, arg.value.str.len);
+		break;
+
+#if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
+	case FormatArgType::Float:
+	case FormatArgType::SingleFloat:
+		if ((type == FormatArgType::SingleFloat) || (sizeof(FloatType) == sizeof(float)))
+		{
+			float value = (float)arg.value.f;
+			uint32_t bits = 0;
+			memcpy(&bits, &value, sizeof(bits));
+			buf[0] = (uint8_t)FormatArgType::SingleFloat;
+			len += write_le(buf + len, bits, 4);
+		}
+		else
+		{
+			double value = (double)arg.value.f;
+			uint64_t bits = 0;
+			memcpy(&bits, &value, sizeof(bits));
+			len += write_le(buf + len, bits, 8);
+		}
+		break;
+#endif
+
+	default:
+		break;
+	}
+
+	return len;
+}
+
+size_t write_id_record(FormatBlockCallback callback, void* data, uint32_t id, const FormatArg* args, ArgTypesDesc arg_types, int args_count)
+{
+	uint8_t buf[16];
+
+	size_t payload_len = write_varint(buf, id) + 1;
+	for (int i = 0; i < args_count; i++)
+	{
+		auto type = unpack_arg_type(arg_types, i);
+		payload_len += encode_arg(args[i], type, buf);
+		if (type == FormatArgType::CharPtr)
+			payload_len += strlen(get_arg_str(args[i])) + 1;
+		else if (type == FormatArgType::StrView)
+			payload_len += args[i].value.str.len;
+	}
+
+	int len = write_varint(buf, payload_len);
+	len += write_varint(buf + len, id);
+	buf[len++] = (uint8_t)args_count;
+	size_t printed = callback(data, (const char*)buf, len);
+
+	for (int i = 0; i < args_count; i++)
+	{
+		auto type = unpack_arg_type(arg_types, i);
+		len = encode_arg(args[i], type, buf);
+		printed += callback(data, (const char*)buf, len);
+
+		if (type == FormatArgType::CharPtr)
+		{
+			const char* str = get_arg_str(args[i]);
+			printed += callback(data, str, strlen(str) + 1);
+		}
+		else if ((type == FormatArgType::StrView) && args[i].value.str.len)
+			printed += callback(data, args[i].value.str.str, args[i].value.str.len);
+	}
+
+	return printed;
+}
+
+// Reads argument and creates FormatArg of host types
+static bool decode_arg(const uint8_t*& ptr, const uint8_t* end, FormatArg& arg, FormatArgType& type)
+{
+	if (ptr == end) return false;
+	type = (FormatArgType)*ptr++;
+	uint64_t value = 0;
+
+	switch (type)
+	{
+	case FormatArgType::Char:
+	case FormatArgType::UChar:
+	case FormatArgType::Bool:
+		if (ptr == end) return false;
+		value = *ptr++;
+		if (type == FormatArgType::Char) arg = FormatArg((char)value);
+		else if (type == FormatArgType::UChar) arg = FormatArg((unsigned char)value);
+		else arg = FormatArg(value != 0);
+		return true;
+
+	case FormatArgType::Int:
+		if (!read_varint(ptr, end, value)) return false;
+		arg = FormatArg((IntType)((value >> 1) ^ (0 - (value & 1))));
+		return true;
+
+	case FormatArgType::UInt:
+		if (!read_varint(ptr, end, value)) return false;
+		arg = FormatArg((UIntType)value);
+		return true;
+
+	case FormatArgType::Pointer:
+		if (!read_varint(ptr, end, value)) return false;
+		arg = FormatArg((const void*)(uintptr_t)value);
+		return true;
+
+	case FormatArgType::CharPtr:
+	{
+		auto* str_end = (const uint8_t*)memchr(ptr, 0, end - ptr);
+		if (!str_end) return false;
+		arg = FormatArg((const char*)ptr);
+		ptr = str_end + 1;
+		return true;
+	}
+
+	case FormatArgType::StrView:
+		if (!read_varint(ptr, end, value) || (value > (uint64_t)(end - ptr))) return false;
+		arg = FormatArg(str_view((const char*)ptr, (size_t)value));
+		ptr += value;
+		return true;
+
+	case FormatArgType::Float:
+	case FormatArgType::SingleFloat:
+	{
+		int size = (type == FormatArgType::Float) ? 8 : 4;
+		if (end - ptr < size) return false;
+		value = read_le(ptr, size);
+		ptr += size;
+		arg = FormatArg();
+		type = FormatArgType::Undef;
+
+#if defined (MICRO_FORMAT_DOUBLE) || defined (MICRO_FORMAT_FLOAT)
+		if (size == 8)
+		{
+			double double_value = 0;
+			memcpy(&double_value, &value, sizeof(double_value));
+			arg = FormatArg((FloatType)double_value);
+			type = FormatArgType::Float;
+		}
+		else
+		{
+			uint32_t bits = (uint32_t)value;
+			float float_value = 0;
+			memcpy(&float_value, &bits, sizeof(float_value));
+			arg = FormatArg(float_value);
+			type = get_arg_type<float>();
+		}
+#endif
+		return true;
+	}
+
+	default:
+		return false;
+	}
+}
+
+} // namespace impl
+
+size_t decode_id_record(
+	const char* strings, size_t strings_size,
+	const uint8_t* record, size_t len,
+	FormatBlockCallback callback, void* data)
+{
+	const uint8_t* ptr = record;
+	const uint8_t* end = record + len;
+
+	uint64_t payload_len = 0;
+	if (!impl::read_varint(ptr, end, payload_len) || (payload_len > (uint64_t)(end - ptr)))
+		return 0;
+
+	end = ptr + payload_len;
+	size_t record_len = end - record;
+
+	uint64_t id = 0;
+	if (!impl::read_varint(ptr, end, id) || (id >= strings_size) || (ptr == end))
+		return 0;
+
+	const char* format_str = strings + id;
+	if (!memchr(format_str, 0, strings_size - id))
+		return 0;
+
+	int args_count = *ptr++;
+
+	impl::FormatArg args[impl::max_record_args_count];
+	impl::FormatArgType types[impl::max_record_args_count];
+	for (int i = 0; i < args_count; i++)
+	{
+		if (!impl::decode_arg(ptr, end, args[i], types[i]))
+			return 0;
+	}
+
+	impl::FormatCtx ctx{ { nullptr, callback, data, 0 }, args, { 0, types }, args_count };
+	impl::format_impl(ctx, format_str);
+
+	return record_len;
+}
+
+} // namespace mf
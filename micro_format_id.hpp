@@ -0,0 +1,95 @@
+/* C++ library for std::format-like text formating for microcontrollers
+   https://github.com/art-den/micro_format
+
+   MIT License
+
+   Copyright (c) 2020-2021 Artyomov Denis (denis.artyomov@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+#pragma once
+
+#include "micro_format.hpp"
+
+// Transport of format strings by ID. Format strings are placed into "mf_fmt"
+// section and ID of string is its offset in section. Only ID and binary
+// encoded arguments are sent, text is restored on host by tools/mf_decode.
+// Section takes flash unless linker script makes it non-allocated (see README)
+//
+// Record: varint(payload len), payload: varint(ID), args count (1 byte),
+// for each argument: FormatArgType (1 byte) and value:
+//   Char, UChar, Bool     - 1 byte
+//   Int                   - zigzag varint
+//   UInt, Pointer         - varint
+//   CharPtr               - characters and zero
+//   StrView               - varint(length) and characters
+//   Float                 - 8 bytes (little endian double)
+//   SingleFloat           - 4 bytes (little endian float)
+
+namespace mf {
+
+namespace impl {
+
+// Number of arguments is stored in one byte of record
+const int max_record_args_count = 255;
+
+// Returns ID of format string placed into "mf_fmt" section
+uint32_t get_format_id(const char* format_str);
+
+size_t write_id_record(FormatBlockCallback callback, void* data, uint32_t id, const FormatArg* args, ArgTypesDesc arg_types, int args_count);
+
+} // namespace impl
+
+// Sends ID of format string and arguments to callback.
+// ID is created by MF_FMT_ID macro. Returns number of bytes of record
+template <typename ... Args>
+size_t format_id(FormatBlockCallback callback, void* data, uint32_t id, const Args& ... args)
+{
+	static_assert(!impl::has_arg_type(impl::ArgTypes<Args...>::desc, sizeof ... (args), impl::FormatArgType::Custom), "Custom types can't be sent by ID");
+	static_assert(sizeof ... (args) <= impl::max_record_args_count, "Too many arguments for record");
+
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	const impl::FormatArg args_arr[arr_size] = { args ... };
+	return impl::write_id_record(callback, data, id, args_arr, impl::ArgTypes<Args...>::desc, sizeof ... (args));
+}
+
+// Decodes one record. strings is content of "mf_fmt" section. Returns number
+// of bytes of record or 0 if record is not complete or wrong
+size_t decode_id_record(
+	const char* strings, size_t strings_size,
+	const uint8_t* record, size_t len,
+	FormatBlockCallback callback, void* data
+);
+
+} // namespace mf
+
+// Section is used only by gcc and clang for ELF targets. Other compilers
+// keep plain literal and ID is its address (tools/mf_decode can't restore it)
+#if defined (__GNUC__) && defined (__ELF__)
+#define MF_FMT_ID_SECTION __attribute__((section("mf_fmt"), used))
+#else
+#define MF_FMT_ID_SECTION
+#endif
+
+// Places format string into "mf_fmt" section and returns its ID
+#define MF_FMT_ID(format_str) \
+	([]() -> uint32_t { \
+		MF_FMT_ID_SECTION static const char str[] = format_str; \
+		return mf::impl::get_format_id(str); \
+	}())
@@ -0,0 +1,346 @@
+/* C++ library for std::format-like text formating for microcontrollers
+   https://github.com/art-den/micro_format
+
+   MIT License
+
+   Copyright (c) 2020-2021 Artyomov Denis (denis.artyomov@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+#pragma once
+
+#include <atomic>
+#include <string.h>
+#include "micro_format.hpp"
+
+#if defined (__cpp_lib_atomic_is_always_lock_free)
+#define MF_RING_IS_LOCK_FREE (std::atomic<uint32_t>::is_always_lock_free)
+#else
+#define MF_RING_IS_LOCK_FREE ((ATOMIC_INT_LOCK_FREE == 2) && (ATOMIC_LONG_LOCK_FREE == 2))
+#endif
+
+namespace mf {
+
+// Lock-free ring buffer of text records for many producers (threads or
+// interrupt handlers) and one consumer. Record takes whole number of cells
+// and never wraps around end of buffer. Each cell has state word which is
+// non-zero only for the first cell of committed record.
+// Compare-and-swap of std::atomic is not lock-free on some targets (cortex-m0),
+// define MICRO_FORMAT_RING_NOT_LOCK_FREE to use library atomics there
+template <size_t CellsCount, size_t CellSize = 16>
+class RingBuffer
+{
+	static_assert((CellsCount & (CellsCount - 1)) == 0, "CellsCount must be power of 2");
+#if !defined (MICRO_FORMAT_RING_NOT_LOCK_FREE)
+	static_assert(MF_RING_IS_LOCK_FREE, "std::atomic<uint32_t> is not lock-free. Define MICRO_FORMAT_RING_NOT_LOCK_FREE to use it anyway");
+#endif
+
+public:
+	RingBuffer()
+	{
+		for (auto& state : states_)
+			state.store(0, std::memory_order_relaxed);
+	}
+
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator = (const RingBuffer&) = delete;
+
+	// Reserves space for record of len characters. Returns nullptr if
+	// there is no free space. Record must be commited by commit()
+	char* reserve(size_t len)
+	{
+		uint32_t cells = get_cells_count(len);
+		if (cells > CellsCount)
+		{
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		uint32_t pos = write_pos_.load(std::memory_order_relaxed);
+		uint32_t skip = 0;
+
+		for (;;)
+		{
+			// record doesn't fit before end of buffer: skip rest of cells
+			uint32_t index = pos & mask;
+			skip = (index + cells > CellsCount) ? (CellsCount - index) : 0;
+
+			if (pos + skip + cells - read_pos_.load(std::memory_order_acquire) > CellsCount)
+			{
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+
+			if (write_pos_.compare_exchange_weak(pos, pos + skip + cells, std::memory_order_relaxed))
+				break;
+		}
+
+		if (skip)
+			states_[pos & mask].store(skip_state, std::memory_order_release);
+
+		return data_ + ((pos + skip) & mask) * CellSize;
+	}
+
+	// Makes record visible for consumer
+	void commit(char* record, size_t len)
+	{
+		size_t index = (record - data_) / CellSize;
+		states_[index].store((uint32_t)len + 1, std::memory_order_release);
+	}
+
+	// Formats text directly into reserved record. Length of record is
+	// computed by formatted_size. Returns false if record is dropped
+	template <typename FormatStr, typename ... Args>
+	bool format(FormatStr format_str, const Args& ... args)
+	{
+		size_t len = formatted_size(format_str, args...);
+		char* record = reserve(len);
+		if (!record) return false;
+
+		impl::FormatBufData data = { record, len };
+		mf::format(impl::format_buf_block_callback, &data, format_str, args...);
+
+		commit(record, len);
+		return true;
+	}
+
+	// Passes committed records to callback in order of reservation. Stops at
+	// first record which is not committed yet or which is accepted by callback
+	// partly. Rest of such record is passed by next call. Returns number of
+	// completely passed records
+	size_t drain(FormatBlockCallback callback, void* data)
+	{
+		return drain_impl([=](const char* text, size_t len) { return callback(data, text, len); });
+	}
+
+	// Passes characters of committed records to callback. Stops at first
+	// character which is not accepted. Returns number of completely passed records
+	size_t drain(FormatCallback callback, void* data)
+	{
+		return drain_impl([=](const char* text, size_t len) {
+			size_t accepted = 0;
+			while ((accepted < len) && callback(data, text[accepted])) accepted++;
+			return accepted;
+		});
+	}
+
+	// Number of records dropped because of lack of free space
+	uint32_t get_dropped_count() const
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+private:
+	static constexpr uint32_t mask = CellsCount - 1;
+	static constexpr uint32_t skip_state = 0xFFFFFFFFUL;
+
+	// positions are counters of cells, index in buffer is position & mask
+	std::atomic<uint32_t> write_pos_ { 0 };
+	std::atomic<uint32_t> read_pos_ { 0 };
+	std::atomic<uint32_t> dropped_ { 0 };
+	size_t read_offset_ = 0; // characters of first record passed to consumer
+	std::atomic<uint32_t> states_[CellsCount];
+	alignas(impl::FormatArg) char data_[CellsCount * CellSize];
+
+	static uint32_t get_cells_count(size_t len)
+	{
+		size_t cells = (len + CellSize - 1) / CellSize;
+		if (cells == 0) cells = 1;
+		return (cells > CellsCount) ? (CellsCount + 1) : (uint32_t)cells;
+	}
+
+	template <typename Fun>
+	size_t drain_impl(const Fun& fun)
+	{
+		size_t records = 0;
+		uint32_t pos = read_pos_.load(std::memory_order_relaxed);
+
+		while (pos != write_pos_.load(std::memory_order_acquire))
+		{
+			uint32_t index = pos & mask;
+			uint32_t state = states_[index].load(std::memory_order_acquire);
+			if (state == 0) break;
+
+			if (state == skip_state)
+				pos += CellsCount - index;
+			else
+			{
+				size_t len = state - 1;
+				size_t rest = len - read_offset_;
+				size_t accepted = fun(data_ + index * CellSize + read_offset_, rest);
+				if (accepted < rest)
+				{
+					read_offset_ += accepted;
+					break;
+				}
+				read_offset_ = 0;
+				pos += get_cells_count(len);
+				records++;
+			}
+
+			// free cells for producers
+			states_[index].store(0, std::memory_order_relaxed);
+			read_pos_.store(pos, std::memory_order_release);
+		}
+
+		return records;
+	}
+};
+
+// Marks string argument of log_deferred to be copied into record
+struct CopyStr
+{
+	const char* str;
+};
+
+inline CopyStr copy_str(const char* str)
+{
+	return { str };
+}
+
+namespace impl {
+
+// Binary record of log_deferred: header, arguments and copied strings
+struct DeferredHeader
+{
+	ArgTypesDesc arg_types;
+	const char* format_str;
+	size_t args_count;
+};
+
+static_assert(sizeof(DeferredHeader) % alignof(FormatArg) == 0, "Wrong alignment of deferred arguments");
+
+template <typename T>
+const T& get_deferred_value(const T& value) { return value; }
+
+inline const char* get_deferred_value(const CopyStr& value) { return value.str; }
+
+template <typename T>
+const char* get_str_to_copy(const T&) { return nullptr; }
+
+inline const char* get_str_to_copy(const CopyStr& value) { return value.str; }
+
+// Record is aligned for FormatArg only, header (uint64_t) is copied out
+inline size_t format_deferred_record(DstData dst, const char* record)
+{
+	DeferredHeader header;
+	memcpy(&header, record, sizeof(header));
+	auto* args = (const FormatArg*)(record + sizeof(DeferredHeader));
+	FormatCtx ctx{ dst, args, header.arg_types, (int)header.args_count };
+	format_impl(ctx, header.format_str);
+	return ctx.dst.chars_printed;
+}
+
+struct DeferredDrainData
+{
+	FormatCallback callback;
+	FormatBlockCallback block_callback;
+	void* data;
+};
+
+// Record is formatted once, text which is not accepted by callback is lost
+inline size_t deferred_drain_callback(void* data, const char* record, size_t len)
+{
+	auto* d = (DeferredDrainData*)data;
+	format_deferred_record({ d->callback, d->block_callback, d->data, 0 }, record);
+	return len;
+}
+
+} // namespace impl
+
+// Stores format string pointer and arguments into ring buffer without
+// formatting. format_str must be valid until record is drained (string literal).
+// Strings passed by copy_str(), std::string, std::string_view and str_view()
+// are copied into record, const char* strings are stored by pointer.
+// Returns false if record is dropped
+template <size_t CellsCount, size_t CellSize, typename ... Args>
+bool log_deferred(RingBuffer<CellsCount, CellSize>& sink, const char* format_str, const Args& ... args)
+{
+	static_assert(CellSize % alignof(impl::FormatArg) == 0, "CellSize must be multiple of FormatArg alignment");
+
+	using ArgTypes = impl::ArgTypes<typename std::decay<decltype(impl::get_deferred_value(args))>::type...>;
+	static_assert(!impl::has_arg_type(ArgTypes::desc, sizeof ... (args), impl::FormatArgType::Custom), "Custom types can't be deferred");
+
+	constexpr unsigned arr_size = (sizeof ... (args)) ? (sizeof ... (args)) : 1;
+	impl::FormatArg args_arr[arr_size] = { impl::get_deferred_value(args) ... };
+	const char* strs[arr_size] = { impl::get_str_to_copy(args) ... };
+
+	// string views may point to temporary objects
+	auto is_str_view = [](size_t index) {
+		return impl::unpack_arg_type(ArgTypes::desc, (int)index) == impl::FormatArgType::StrView;
+	};
+
+	size_t args_len = sizeof(impl::DeferredHeader) + sizeof(impl::FormatArg) * sizeof ... (args);
+	size_t len = args_len;
+	for (size_t i = 0; i < sizeof ... (args); i++)
+	{
+		if (strs[i]) len += strlen(strs[i]) + 1;
+		else if (is_str_view(i)) len += args_arr[i].value.str.len;
+	}
+
+	char* record = sink.reserve(len);
+	if (!record) return false;
+
+	char* str_ptr = record + args_len;
+	for (size_t i = 0; i < sizeof ... (args); i++)
+	{
+		if (strs[i])
+		{
+			size_t str_size = strlen(strs[i]) + 1;
+			memcpy(str_ptr, strs[i], str_size);
+			args_arr[i].value.p = (uintptr_t)str_ptr;
+			str_ptr += str_size;
+		}
+		else if (is_str_view(i))
+		{
+			auto& str = args_arr[i].value.str;
+			if (str.len) memcpy(str_ptr, str.str, str.len);
+			str.str = str_ptr;
+			str_ptr += str.len;
+		}
+	}
+
+	impl::DeferredHeader header = { ArgTypes::desc, format_str, sizeof ... (args) };
+	memcpy(record, &header, sizeof(header));
+	memcpy(record + sizeof(header), args_arr, sizeof(impl::FormatArg) * sizeof ... (args));
+
+	sink.commit(record, len);
+	return true;
+}
+
+// Formats records stored by log_deferred passing text of each record to callback.
+// Each record is formatted once: text which is not accepted by callback is lost.
+// Returns number of records
+template <size_t CellsCount, size_t CellSize>
+size_t drain_deferred(RingBuffer<CellsCount, CellSize>& sink, FormatBlockCallback callback, void* data)
+{
+	impl::DeferredDrainData drain_data = { nullptr, callback, data };
+	return sink.drain(impl::deferred_drain_callback, &drain_data);
+}
+
+// Formats records stored by log_deferred calling callback for each character.
+// Returns number of records
+template <size_t CellsCount, size_t CellSize>
+size_t drain_deferred(RingBuffer<CellsCount, CellSize>& sink, FormatCallback callback, void* data)
+{
+	impl::DeferredDrainData drain_data = { callback, nullptr, data };
+	return sink.drain(impl::deferred_drain_callback, &drain_data);
+}
+
+} // namespace mf
@@ -0,0 +1,553 @@
+// Benchmark of mf::format against snprintf and std::format
+//
+// Build (std::format is used if compiler has it, add -DMICRO_FORMAT_SHORTEST_FLOAT for "{:e}" and "{}"):
+//   g++ -std=c++20 -O2 -pthread -DMICRO_FORMAT_DOUBLE micro_format_bench.cpp ../micro_format.cpp -o micro_format_bench
+//   cl /std:c++latest /O2 /EHsc /utf-8 /DMICRO_FORMAT_DOUBLE micro_format_bench.cpp ..\micro_format.cpp
+// 64-bit integers on 32-bit target:
+//   g++ -m32 -std=c++20 -O2 -pthread -DMICRO_FORMAT_DOUBLE -DMICRO_FORMAT_INT64 micro_format_bench.cpp ../micro_format.cpp -o micro_format_bench
+//
+// Code size of each mf::format instantiation for -Os build:
+//   g++ -std=c++20 -Os -ffunction-sections -DMICRO_FORMAT_DOUBLE -c micro_format_bench.cpp
+//   nm --print-size --size-sort -C micro_format_bench.o | grep "mf::format"
+// Use arm-none-eabi-g++ and arm-none-eabi-nm to get sizes for microcontroller
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#if defined (__has_include)
+#if __has_include(<format>) && (__cplusplus >= 202002L || _MSVC_LANG >= 202002L)
+#include <format>
+#if defined (__cpp_lib_format)
+#define HAS_STD_FORMAT
+#endif
+#endif
+#endif
+
+#include "../micro_format.hpp"
+#include "../micro_format_ring.hpp"
+#include "../micro_format_cache.hpp"
+#include "../micro_format_batch.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t values_count = 256;
+static const size_t iterations = 2'000'000;
+static const size_t buffer_size = 128;
+
+static int int_values[values_count];
+static unsigned uint_values[values_count];
+static double float_values[values_count];
+static const char* str_values[values_count];
+
+static volatile size_t sink = 0;
+
+static void init_values()
+{
+	static const char* strings[] = { "", "a", "text", "longer text", "very long text value" };
+
+	std::mt19937 gen(42);
+	for (size_t i = 0; i < values_count; i++)
+	{
+		int_values[i] = (int)gen() >> (gen() % 31);
+		uint_values[i] = gen() >> (gen() % 32);
+		float_values[i] = (double)(int)gen() / (double)(gen() % 100'000 + 1);
+		str_values[i] = strings[i % (sizeof(strings) / sizeof(strings[0]))];
+	}
+}
+
+static void print_header(const char* workload)
+{
+	printf("\n%s\n", workload);
+}
+
+// Calls fun(buffer, index) for each iteration and prints ns/call and chars/sec
+template <typename Fun>
+static void bench(const char* name, const Fun& fun)
+{
+	char buffer[buffer_size];
+	size_t chars = 0;
+
+	for (size_t i = 0; i < values_count; i++)
+		chars += fun(buffer, i);
+
+	chars = 0;
+	auto start = Clock::now();
+
+	for (size_t i = 0; i < iterations; i++)
+		chars += fun(buffer, i % values_count);
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	sink = sink + chars;
+
+	printf(
+		"  %-20s %8.1f ns/call %10.1f Mchars/sec\n",
+		name,
+		1e9 * seconds / iterations,
+		chars / seconds / 1e6
+	);
+}
+
+static void bench_int()
+{
+	print_header("int \"{}\"");
+
+	bench("mf::format", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{}", int_values[i]);
+	});
+
+	bench("snprintf", [](char* buf, size_t i) {
+		return (size_t)snprintf(buf, buffer_size, "%d", int_values[i]);
+	});
+
+#if defined (HAS_STD_FORMAT)
+	bench("std::format", [](char* buf, size_t i) {
+		return (size_t)std::format_to_n(buf, buffer_size, "{}", int_values[i]).size;
+	});
+#endif
+}
+
+// 64-bit counters and timestamps
+static void bench_uint64()
+{
+#if defined (MICRO_FORMAT_INT64) || (ULONG_MAX > 0xFFFFFFFFUL)
+	static mf::impl::UIntType values[values_count];
+
+	std::mt19937_64 gen(42);
+	for (auto& value : values)
+		value = gen() >> (gen() % 40);
+
+	print_header("uint64 \"{}\"");
+
+	bench("mf::format", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{}", values[i]);
+	});
+
+	bench("snprintf", [](char* buf, size_t i) {
+		return (size_t)snprintf(buf, buffer_size, "%llu", (unsigned long long)values[i]);
+	});
+
+#if defined (HAS_STD_FORMAT)
+	bench("std::format", [](char* buf, size_t i) {
+		return (size_t)std::format_to_n(buf, buffer_size, "{}", values[i]).size;
+	});
+#endif
+#endif
+}
+
+static void bench_int_padded()
+{
+	print_header("int with width \"{:+12}\"");
+
+	bench("mf::format", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{:+12}", int_values[i]);
+	});
+
+	bench("snprintf", [](char* buf, size_t i) {
+		return (size_t)snprintf(buf, buffer_size, "%+12d", int_values[i]);
+	});
+
+#if defined (HAS_STD_FORMAT)
+	bench("std::format", [](char* buf, size_t i) {
+		return (size_t)std::format_to_n(buf, buffer_size, "{:+12}", int_values[i]).size;
+	});
+#endif
+}
+
+static void bench_hex()
+{
+	print_header("hex \"{:08x}\"");
+
+	bench("mf::format", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{:08x}", uint_values[i]);
+	});
+
+	bench("snprintf", [](char* buf, size_t i) {
+		return (size_t)snprintf(buf, buffer_size, "%08x", uint_values[i]);
+	});
+
+#if defined (HAS_STD_FORMAT)
+	bench("std::format", [](char* buf, size_t i) {
+		return (size_t)std::format_to_n(buf, buffer_size, "{:08x}", uint_values[i]).size;
+	});
+#endif
+}
+
+static void bench_float(const char* workload, const char* mf_format_str, const char* printf_format_str)
+{
+	print_header(workload);
+
+	bench("mf::format", [=](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, mf_format_str, float_values[i]);
+	});
+
+	bench("snprintf", [=](char* buf, size_t i) {
+		return (size_t)snprintf(buf, buffer_size, printf_format_str, float_values[i]);
+	});
+
+#if defined (HAS_STD_FORMAT)
+	bench("std::format", [=](char* buf, size_t i) {
+		return (size_t)(std::vformat_to(buf, mf_format_str, std::make_format_args(float_values[i])) - buf);
+	});
+#endif
+}
+
+static void bench_floats()
+{
+	bench_float("float \"{:.2f}\"", "{:.2f}", "%.2f");
+	bench_float("float \"{:.6f}\"", "{:.6f}", "%.6f");
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+	bench_float("float \"{:e}\"", "{:e}", "%e");
+	bench_float("float shortest \"{}\" (snprintf: %.17g)", "{}", "%.17g");
+#endif
+}
+
+// Same values as Q16.16 fixed-point and as floating point numbers
+static void bench_fixed()
+{
+	static int32_t fixed_values[values_count];
+	static double fixed_as_float[values_count];
+
+	for (size_t i = 0; i < values_count; i++)
+	{
+		fixed_values[i] = int_values[i] >> 8;
+		fixed_as_float[i] = fixed_values[i] / 65536.0;
+	}
+
+	print_header("Q16.16 \"{:.2}\"");
+
+	bench("mf, fixed", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{:.2}", mf::fixed<16>(fixed_values[i]));
+	});
+
+	bench("mf, float", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{:.2}", fixed_as_float[i]);
+	});
+
+	print_header("Q16.16 shortest \"{}\"");
+
+	bench("mf, fixed", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{}", mf::fixed<16>(fixed_values[i]));
+	});
+
+	bench("mf, float {:.5}", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{:.5}", fixed_as_float[i]);
+	});
+}
+
+static void bench_str_padded()
+{
+	print_header("strings with padding \"{:<12}|{:>12}\"");
+
+	bench("mf::format", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "{:<12}|{:>12}", str_values[i], str_values[values_count - 1 - i]);
+	});
+
+	bench("snprintf", [](char* buf, size_t i) {
+		return (size_t)snprintf(buf, buffer_size, "%-12s|%12s", str_values[i], str_values[values_count - 1 - i]);
+	});
+
+#if defined (HAS_STD_FORMAT)
+	bench("std::format", [](char* buf, size_t i) {
+		return (size_t)std::format_to_n(buf, buffer_size, "{:<12}|{:>12}", str_values[i], str_values[values_count - 1 - i]).size;
+	});
+#endif
+}
+
+static void bench_mixed()
+{
+	print_header("mixed \"U={:8.2}v, I={:8.2}A, N={}\"");
+
+	bench("mf::format", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, "U={:8.2}v, I={:8.2}A, N={}", float_values[i], float_values[values_count - 1 - i], int_values[i]);
+	});
+
+	bench("mf::format MF_FMT", [](char* buf, size_t i) {
+		return mf::format(buf, buffer_size, MF_FMT("U={:8.2}v, I={:8.2}A, N={}"), float_values[i], float_values[values_count - 1 - i], int_values[i]);
+	});
+
+	static mf::FormatCache<> cache;
+	static const char* runtime_format_str = "U={:8.2}v, I={:8.2}A, N={}";
+	bench("mf::FormatCache", [](char* buf, size_t i) {
+		return cache.format(buf, buffer_size, runtime_format_str, float_values[i], float_values[values_count - 1 - i], int_values[i]);
+	});
+
+	bench("mf::formatted_size", [](char*, size_t i) {
+		return mf::formatted_size("U={:8.2}v, I={:8.2}A, N={}", float_values[i], float_values[values_count - 1 - i], int_values[i]);
+	});
+
+	bench("snprintf", [](char* buf, size_t i) {
+		return (size_t)snprintf(buf, buffer_size, "U=%8.2fv, I=%8.2fA, N=%d", float_values[i], float_values[values_count - 1 - i], int_values[i]);
+	});
+
+#if defined (HAS_STD_FORMAT)
+	bench("std::format", [](char* buf, size_t i) {
+		return (size_t)std::format_to_n(buf, buffer_size, "U={:8.2f}v, I={:8.2f}A, N={}", float_values[i], float_values[values_count - 1 - i], int_values[i]).size;
+	});
+#endif
+}
+
+static void bench_long_template()
+{
+	print_header("long mostly-literal template (JSON, 3 fields)");
+
+	static const char* mf_format_str =
+		"{\"device\": {{\"name\": \"micro_format benchmark device\", \"firmware\": \"1.2.3\", "
+		"\"location\": \"laboratory room 42, shelf 3\"}}, \"sensors\": [{{\"type\": \"voltage\", "
+		"\"unit\": \"V\", \"value\": {:.3f}}}, {{\"type\": \"counter\", \"unit\": \"pcs\", "
+		"\"value\": {}}}], \"status\": \"{}\", \"comment\": \"all values are measured by "
+		"internal ADC and filtered by moving average of 16 samples\"}}";
+
+	static const char* printf_format_str =
+		"{\"device\": {\"name\": \"micro_format benchmark device\", \"firmware\": \"1.2.3\", "
+		"\"location\": \"laboratory room 42, shelf 3\"}, \"sensors\": [{\"type\": \"voltage\", "
+		"\"unit\": \"V\", \"value\": %.3f}, {\"type\": \"counter\", \"unit\": \"pcs\", "
+		"\"value\": %d}], \"status\": \"%s\", \"comment\": \"all values are measured by "
+		"internal ADC and filtered by moving average of 16 samples\"}";
+
+	static char buffer[1024];
+
+	bench("mf::format", [](char*, size_t i) {
+		return mf::format(buffer, mf_format_str, float_values[i], int_values[i], str_values[i]);
+	});
+
+	bench("snprintf", [](char*, size_t i) {
+		return (size_t)snprintf(buffer, sizeof(buffer), printf_format_str, float_values[i], int_values[i], str_values[i]);
+	});
+
+#if defined (HAS_STD_FORMAT)
+	bench("std::format", [](char*, size_t i) {
+		return (size_t)(std::vformat_to(buffer, mf_format_str, std::make_format_args(float_values[i], int_values[i], str_values[i])) - buffer);
+	});
+#endif
+}
+
+static void bench_utf8()
+{
+	print_header("UTF-8 \"Текст {} 日本語 {}\" (mf::format_u8 only)");
+
+	auto wide_char_cb = [](void* data, mf::WideChar chr)
+	{
+		*(mf::WideChar*)data = chr;
+		return true;
+	};
+
+	bench("mf::format_u8", [=](char*, size_t i) {
+		mf::WideChar last_char = 0;
+		return mf::format_u8(wide_char_cb, &last_char, "Текст {} 日本語 {}", int_values[i], "テキスト");
+	});
+
+	print_header("UTF-8 mostly ASCII text with Cyrillic (mf::format_u8 only)");
+
+	static const char* display_format_str =
+		"Channel 1: voltage {:8.3} V, current {:8.3} A, state: {}. Канал в норме, "
+		"last calibration was made at factory, next one is required after {} hours of work";
+
+	bench("mf::format_u8", [=](char*, size_t i) {
+		mf::WideChar last_char = 0;
+		return mf::format_u8(wide_char_cb, &last_char, display_format_str, float_values[i], float_values[values_count - 1 - i], str_values[i], uint_values[i]);
+	});
+
+	auto wide_block_cb = [](void* data, const mf::WideChar* text, size_t len)
+	{
+		*(mf::WideChar*)data = text[len - 1];
+		return len;
+	};
+
+	bench("mf::format_u8 block", [=](char*, size_t i) {
+		mf::WideChar last_char = 0;
+		return mf::format_u8(wide_block_cb, &last_char, display_format_str, float_values[i], float_values[values_count - 1 - i], str_values[i], uint_values[i]);
+	});
+}
+
+// Producers format records into ring buffer while one consumer drains it
+static void bench_ring_buffer_contention(int threads_count)
+{
+	const int records_per_thread = 200'000;
+
+	static mf::RingBuffer<4096> ring;
+	std::atomic<int> working_threads { threads_count };
+	std::atomic<size_t> retries { 0 };
+	std::vector<std::thread> threads;
+
+	auto start = Clock::now();
+
+	for (int t = 0; t < threads_count; t++)
+	{
+		threads.emplace_back([&, t] {
+			size_t thread_retries = 0;
+			for (int i = 0; i < records_per_thread; i++)
+			{
+				size_t index = (size_t)(i + t) % values_count;
+				while (!ring.format("thread {} record {}: {:8.2} {}", t, i, float_values[index], str_values[index]))
+				{
+					thread_retries++;
+					std::this_thread::yield();
+				}
+			}
+			retries += thread_retries;
+			working_threads--;
+		});
+	}
+
+	size_t chars = 0;
+	auto count_chars = [](void* data, const char*, size_t len)
+	{
+		*(size_t*)data += len;
+		return len;
+	};
+
+	while (working_threads != 0)
+		ring.drain(count_chars, &chars);
+	ring.drain(count_chars, &chars);
+
+	for (auto& thread : threads)
+		thread.join();
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	size_t records = (size_t)threads_count * records_per_thread;
+	sink = sink + chars;
+
+	printf(
+		"  producers: %d %10.1f ns/record %8.1f Mchars/sec %8zu retries\n",
+		threads_count,
+		1e9 * seconds / records,
+		chars / seconds / 1e6,
+		retries.load()
+	);
+}
+
+static void bench_ring_buffer()
+{
+	print_header("mf::RingBuffer, \"thread {} record {}: {:8.2} {}\"");
+
+	for (int threads_count : { 1, 2, 4, 8 })
+		bench_ring_buffer_contention(threads_count);
+}
+
+// Array of 10k numbers printed by mf::format_range against mf::format for each element
+template <typename T>
+static void bench_range_of(const char* workload, const char* format_str, const char* element_format_str, const T* values)
+{
+	const size_t count = 10'000;
+	const int repeats = 200;
+	static char text[count * 32];
+
+	print_header(workload);
+
+	auto print_result = [&](const char* name, double seconds, size_t chars)
+	{
+		sink = sink + chars;
+		printf(
+			"  %-20s %8.1f ns/element %8.1f Mchars/sec\n",
+			name,
+			1e9 * seconds / (count * repeats),
+			chars / seconds / 1e6
+		);
+	};
+
+	size_t chars = 0;
+	auto start = Clock::now();
+	for (int r = 0; r < repeats; r++)
+	{
+		size_t pos = 0;
+		for (size_t i = 0; i < count; i++)
+			pos += mf::format(text + pos, sizeof(text) - pos, element_format_str, values[i]);
+		chars += pos;
+	}
+	print_result("mf::format loop", std::chrono::duration<double>(Clock::now() - start).count(), chars);
+
+	chars = 0;
+	start = Clock::now();
+	for (int r = 0; r < repeats; r++)
+		chars += mf::format_range(text, format_str, values, count);
+	print_result("mf::format_range", std::chrono::duration<double>(Clock::now() - start).count(), chars);
+}
+
+static void bench_range()
+{
+	static int ints[10'000];
+	static float floats[10'000];
+	for (size_t i = 0; i < 10'000; i++)
+	{
+		ints[i] = int_values[i % values_count];
+		floats[i] = (float)float_values[i % values_count];
+	}
+
+	bench_range_of("mf::format_range, int \"{:8}\" and \", \"", "{:8}", "{:8}, ", ints);
+	bench_range_of("mf::format_range, float \"{:6.2}\" and \", \"", "{:6.2}", "{:6.2}, ", floats);
+}
+
+// One call of mf::format_batch for all records against mf::format for each record
+static void bench_batch()
+{
+	const char* format_str = "{},{:.3},{:.3},{}\n";
+	const size_t records_count = 2'000'000;
+
+	print_header("mf::format_batch, CSV \"{},{:.3},{:.3},{}\\n\"");
+
+	std::vector<std::tuple<unsigned, double, double, const char*>> records;
+	records.reserve(records_count);
+	for (size_t i = 0; i < records_count; i++)
+		records.emplace_back((unsigned)i, float_values[i % values_count], float_values[(i + 1) % values_count], str_values[i % values_count]);
+
+	auto print_result = [&](const char* name, double seconds, size_t chars)
+	{
+		sink = sink + chars;
+		printf(
+			"  %-20s %8.1f ns/record %8.1f Mchars/sec\n",
+			name,
+			1e9 * seconds / records_count,
+			chars / seconds / 1e6
+		);
+	};
+
+	{
+		std::string text;
+		auto start = Clock::now();
+		char buffer[buffer_size];
+		for (auto& record : records)
+		{
+			size_t len = mf::format(buffer, buffer_size, format_str, std::get<0>(record), std::get<1>(record), std::get<2>(record), std::get<3>(record));
+			text.append(buffer, len);
+		}
+		print_result("mf::format loop", std::chrono::duration<double>(Clock::now() - start).count(), text.size());
+	}
+
+	for (unsigned threads_count : { 1, 2, 4, 8 })
+	{
+		std::string text;
+		auto start = Clock::now();
+		mf::format_batch(text, format_str, records, threads_count);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		char name[32];
+		mf::format(name, "threads: {}", threads_count);
+		print_result(name, seconds, text.size());
+	}
+}
+
+int main()
+{
+	init_values();
+
+	bench_int();
+	bench_uint64();
+	bench_int_padded();
+	bench_hex();
+	bench_floats();
+	bench_fixed();
+	bench_str_padded();
+	bench_mixed();
+	bench_long_template();
+	bench_utf8();
+	bench_ring_buffer();
+	bench_range();
+	bench_batch();
+}
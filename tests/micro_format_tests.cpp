@@ -1,4 +1,7 @@
 ﻿#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
 
 #include <string.h>
 #include <stdio.h>
@@ -8,19 +11,82 @@
 #include <boost/locale.hpp>
 
 #include "../micro_format.hpp"
+#include "../micro_format_ring.hpp"
+#include "../micro_format_id.hpp"
+#include "../micro_format_cache.hpp"
+#include "../micro_format_batch.hpp"
 
 static const std::string error_str = "{{error}}";
 
+struct Ip4
+{
+	uint8_t a, b, c, d;
+};
+
+enum class State { Idle, Running };
+
+struct Name
+{
+	const char* text;
+};
+
+namespace mf {
+
+template <>
+struct formatter<Ip4>
+{
+	static void format(mf::FormatDst& dst, const mf::FormatSpec&, const Ip4& ip)
+	{
+		mf::format(dst, "{}.{}.{}.{}", (unsigned)ip.a, (unsigned)ip.b, (unsigned)ip.c, (unsigned)ip.d);
+	}
+};
+
+template <>
+struct formatter<State>
+{
+	// 'd' presentation prints number of state
+	static void format(mf::FormatDst& dst, const mf::FormatSpec& spec, const State& state)
+	{
+		if (spec.format == 'd')
+			mf::format(dst, MF_FMT("{}"), (int)state);
+		else if (state == State::Idle)
+			mf::put_text(dst, "idle", 4);
+		else
+			mf::put_text(dst, "running", 7);
+	}
+};
+
+template <>
+struct formatter<Name>
+{
+	static void format(mf::FormatDst& dst, const mf::FormatSpec&, const Name& name)
+	{
+		mf::put_text(dst, name.text, strlen(name.text));
+	}
+};
+
+} // namespace mf
+
 template <typename ... Args>
 void test_eq(const std::string &desired, const char *format_str, const Args& ... args)
 {
 	char result[256] = {};
 	mf::format(result, format_str, args...);
 	assert(desired == result);
+	assert(mf::formatted_size(format_str, args...) == desired.size());
 }
 
-template <typename ... Args>
-void test_eq_unicode(const std::string& desired, const char* format_str, const Args& ... args)
+template <typename Str, typename ... Args>
+void test_eq(const std::string& desired, mf::impl::CompiledStr<Str> format_str, const Args& ... args)
+{
+	char result[256] = {};
+	mf::format(result, format_str, args...);
+	assert(desired == result);
+	assert(mf::formatted_size(format_str, args...) == desired.size());
+}
+
+template <typename FormatStr, typename ... Args>
+void test_eq_unicode(const std::string& desired, FormatStr format_str, const Args& ... args)
 {
 	std::wstring wstr;
 
@@ -36,19 +102,34 @@ void test_eq_unicode(const std::string& desired, const char* format_str, const A
 
 	assert(desired_w == wstr);
 	assert(wide_chars_count == desired_w.size());
+
+	std::wstring block_wstr;
+
+	auto add_wide_block_cb = [](void* data, const mf::WideChar* text, size_t len)
+	{
+		auto* str = (std::wstring*)data;
+		str->append(text, text + len);
+		return len;
+	};
+
+	wide_chars_count = mf::format_u8(add_wide_block_cb, &block_wstr, format_str, args...);
+	assert(desired_w == block_wstr);
+	assert(wide_chars_count == desired_w.size());
 }
 
-void test_cmp_printf(const char* format_str, double value)
+void test_cmp_printf(const char* format_str, double value, char presentation = 'f')
 {
 	char result[256] = {};
 	std::string fmt1 = "{:";
 	fmt1.append(format_str);
+	if (presentation != 'f') fmt1.push_back(presentation);
 	fmt1.append("}");
 	mf::format(result, fmt1.c_str(), value);
+	assert(mf::formatted_size(fmt1.c_str(), value) == strlen(result));
 
 	std::string fmt2 = "%";
 	fmt2.append(format_str);
-	fmt2.append("f");
+	fmt2.push_back(presentation);
 	char printf_buffer[256] = {};
 	sprintf_s(printf_buffer, fmt2.c_str(), value);
 
@@ -132,10 +213,33 @@ static void test_integer()
 	test_eq("9223372036854775807", "{:}", INT64_MAX);
 	test_eq("-9223372036854775808", "{:}", INT64_MIN);
 #endif
+
+	// digits of 64-bit values are written by chunks of 9 digits
+#if defined (MICRO_FORMAT_INT64) || (ULONG_MAX > 0xFFFFFFFFUL)
+	using UInt = mf::impl::UIntType;
+	using Int = mf::impl::IntType;
+	test_eq("4294967296", "{}", (UInt)4294967296ULL);
+	test_eq("999999999999999999", "{}", (UInt)999999999999999999ULL);
+	test_eq("1000000000000000000", "{}", (UInt)1000000000000000000ULL);
+	test_eq("10000000000000000000", "{}", (UInt)10000000000000000000ULL);
+	test_eq("1000000001000000001", "{}", (UInt)1000000001000000001ULL);
+	test_eq("-1000000000000000007", "{}", (Int)-1000000000000000007LL);
+	test_eq("  12345678901234", "{:16}", (UInt)12345678901234ULL);
+#endif
 	test_eq("4294967295", "{:}", UINT32_MAX);
 	test_eq("2147483647", "{:}", INT32_MAX);
 	test_eq("-2147483648", "{:}", INT32_MIN);
 
+	// decimal lengths around powers of ten
+
+	for (uint32_t value = 1; value <= 1'000'000'000; value *= 10)
+	{
+		test_eq(std::to_string(value - 1), "{}", value - 1);
+		test_eq(std::to_string(value), "{}", value);
+		test_eq(std::to_string(value + 1), "{}", value + 1);
+		test_eq(std::string(11 - std::to_string(value).size(), ' ') + std::to_string(value), "{:11}", value);
+	}
+
 	// hex
 
 	test_eq("a",        "{:x}", 0xa);
@@ -193,6 +297,29 @@ static void test_integer()
 #endif
 	test_eq("37777777777", "{:o}", UINT32_MAX);
 
+	// hex, octal and binary lengths around bit boundaries
+
+	for (int bit = 0; bit < 32; bit++)
+	{
+		uint32_t values[] = { (uint32_t)1 << bit, ((uint32_t)1 << bit) - 1, ((uint32_t)1 << bit) + 1 };
+		for (uint32_t value : values)
+		{
+			char printf_buffer[64] = {};
+			sprintf_s(printf_buffer, "%x", value);
+			test_eq(printf_buffer, "{:x}", value);
+			sprintf_s(printf_buffer, "0X%X", value);
+			test_eq(printf_buffer, "{:#X}", value);
+			sprintf_s(printf_buffer, "%o", value);
+			test_eq(printf_buffer, "{:o}", value);
+
+			std::string bin;
+			for (uint32_t v = value; v != 0; v >>= 1)
+				bin.insert(bin.begin(), (v & 1) ? '1' : '0');
+			if (bin.empty()) bin = "0";
+			test_eq(bin, "{:b}", value);
+		}
+	}
+
 	// to char
 
 	test_eq("AB", "{:c}{:c}", 65, 66);
@@ -249,6 +376,39 @@ static void test_str()
 	test_eq(error_str, "{:o}", "str");
 	test_eq(error_str, "{:b}", "str");
 	test_eq(error_str, "{:B}", "str");
+
+	// precision truncates string
+	test_eq("str",     "{:.3}", "string");
+	test_eq("st   |",  "{:5.2s}|", "string");
+	test_eq("   st|",  "{:>5.2}|", "string");
+	test_eq("string",  "{:.10}", "string");
+	test_eq("",        "{:.0}", "string");
+}
+
+static void test_str_view()
+{
+	// not terminated by zero
+	const char buffer[] = { 'p', 'a', 'c', 'k', 'e', 't' };
+	test_eq("pack",    "{}", mf::str_view(buffer, 4));
+	test_eq("pac  |",  "{:5.3}|", mf::str_view(buffer, sizeof(buffer)));
+	test_eq("|  pack|", "|{:>6}|", mf::str_view(buffer, 4));
+	test_eq("packet",  MF_FMT("{:s}"), mf::str_view(buffer, sizeof(buffer)));
+	test_eq("",        "{}", mf::str_view(nullptr, 0));
+	test_eq("pa",      "{:.2}", mf::str_view(buffer, sizeof(buffer)));
+	test_eq(error_str, "{:d}", mf::str_view(buffer, 4));
+
+	// std::string is passed with length
+	std::string str = "text string";
+	test_eq(str,       "{}", str);
+	test_eq("text",    MF_FMT("{:.4}"), str);
+	test_eq("[ text string]", "[{:>12}]", str);
+	assert(mf::formatted_size("{}", std::string("a\0b", 3)) == 3);
+
+#if defined (__cpp_lib_string_view)
+	std::string_view view = "long text";
+	test_eq("text",    "{}", view.substr(5));
+	test_eq("long  |", MF_FMT("{:6.4}|"), view);
+#endif
 }
 
 static void test_char()
@@ -271,8 +431,13 @@ static void test_float()
 {
 	// float
 
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+	test_eq("1.2",       "{}", 1.2f);
+	test_eq("-1.2",      "{}", -1.2f);
+#else
 	test_eq("1.200000",  "{}", 1.2f);
 	test_eq("-1.200000", "{}", -1.2f);
+#endif
 	test_eq("1.200000",  "{:f}",  1.2f);
 	test_eq("1.2",       "{:.1}", 1.2f);
 	test_eq("-1.2",      "{:.1}", -1.2f);
@@ -329,8 +494,13 @@ static void test_float()
 	// double
 
 
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+	test_eq("1.2", "{}", 1.2);
+	test_eq("-1.2", "{}", -1.2);
+#else
 	test_eq("1.200000", "{}", 1.2);
 	test_eq("-1.200000", "{}", -1.2);
+#endif
 
 	test_eq("9.999999", "{}", 9.999999);
 	test_eq("0.999999", "{}", 0.999999);
@@ -340,6 +510,21 @@ static void test_float()
 	test_eq("100000000000000000000.0", "{:.1}", 100000000000000000000.0);
 	test_eq("10000000000000000000000.0", "{:.1}", 10000000000000000000000.0);
 
+	// rounding
+
+	test_eq("10.00", "{:.2}", 9.9999);
+	test_eq("-10.00", "{:.2}", -9.9999);
+	test_eq("0.12", "{:.2}", 0.125);
+	test_eq("0.38", "{:.2}", 0.375);
+	test_eq("2", "{:.0}", 2.5);
+	test_eq("4", "{:.0}", 3.5);
+	test_eq("0.000", "{:.3}", 0.0004);
+	test_eq("0.001", "{:.3}", 0.0006);
+	test_eq("0.0000001", "{:.7}", 0.0000001);
+	test_eq("4294967295.5", "{:.1}", 4294967295.5);
+	test_eq("4294967296.0", "{:.1}", 4294967296.0);
+	test_eq("18446744073709551616.0", "{:.1}", 18446744073709551616.0);
+
 	// compalre with printf
 
 	for (int64_t i = -10'000; i < 1'000'000; i += 11)
@@ -360,6 +545,85 @@ static void test_float()
 		test_cmp_printf(".11", value);
 	}
 
+	for (int64_t i = -100'000; i < 100'000; i += 7)
+	{
+		double value = i / 2048.0;
+		test_cmp_printf(".0", value);
+		test_cmp_printf(".2", value);
+		test_cmp_printf(".3", value);
+	}
+
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+	// shortest round-trip form
+
+	test_eq("0", "{}", 0.0);
+	test_eq("1", "{}", 1.0);
+	test_eq("100", "{}", 100.0);
+	test_eq("0.1", "{}", 0.1);
+	test_eq("0.3", "{}", 0.3);
+	test_eq("0.30000000000000004", "{}", 0.1 + 0.2);
+	test_eq("123456.789", "{}", 123456.789);
+	test_eq("0.001", "{}", 0.001);
+	test_eq("1e-04", "{}", 0.0001);
+	test_eq("1.5e-09", "{}", 1.5e-9);
+	test_eq("1e+16", "{}", 1e16);
+	test_eq("1.7976931348623157e+308", "{}", 1.7976931348623157e308);
+	test_eq("5e-324", "{}", 5e-324);
+	test_eq("2.2250738585072014e-308", "{}", 2.2250738585072014e-308);
+	test_eq("9007199254740994", "{}", 9007199254740992.0 + 2.0);
+	test_eq("0.1", "{}", 0.1f);
+	test_eq("3.4028235e+38", "{}", 3.4028235e38f);
+	test_eq("1e-45", "{}", 1e-45f);
+	test_eq("16777216", "{}", 16777216.0f);
+	test_eq("  1.5", "{:5}", 1.5);
+	test_eq("+1.5", "{:+}", 1.5);
+
+	// e and g presentations
+
+	test_eq("1.200000e+00", "{:e}", 1.2);
+	test_eq("-1.200000E+00", "{:E}", -1.2);
+	test_eq("1.20e+00", "{:.2e}", 1.2f);
+	test_eq("1e+02", "{:.0e}", 123.0);
+	test_eq("0.000000e+00", "{:e}", 0.0);
+	test_eq("1.234568e+300", "{:e}", 1.2345678e300);
+	test_eq("9.9e-100", "{:.1e}", 9.9e-100);
+	test_eq("1.2", "{:g}", 1.2);
+	test_eq("0.0001", "{:g}", 0.0001);
+	test_eq("1e-05", "{:g}", 0.00001);
+	test_eq("100000", "{:g}", 100000.0);
+	test_eq("1E+06", "{:G}", 1000000.0);
+	test_eq("1.2e+02", "{:.2g}", 123.0);
+	test_eq("2", "{:.0g}", 1.5);
+	test_eq("0", "{:g}", 0.0);
+	test_eq("  1.5e+00", "{:9.1e}", 1.5);
+	test_eq("inf", "{:e}", INFINITY);
+	test_eq("NAN", "{:G}", NAN);
+
+	for (int64_t i = -100'000; i < 100'000; i += 7)
+	{
+		double value = i / 2048.0;
+		test_cmp_printf(".0", value, 'e');
+		test_cmp_printf(".3", value, 'e');
+		test_cmp_printf(".3", value, 'g');
+	}
+
+	for (int64_t i = 1; i < 1'000'000'000; i += 10003)
+	{
+		double value = i / 13.777e7;
+		test_cmp_printf("", value, 'e');
+		test_cmp_printf(".12", value, 'e');
+		test_cmp_printf("", value, 'g');
+		test_cmp_printf(".15", value, 'g');
+	}
+#else
+	// e and g presentations need MICRO_FORMAT_SHORTEST_FLOAT
+
+	test_eq(error_str, "{:e}", 1.2);
+	test_eq(error_str, "{:E}", 1.2f);
+	test_eq(error_str, "{:g}", 1.2);
+	test_eq(error_str, "{:G}", 1.2f);
+#endif
+
 	// errors
 
 	test_eq(error_str, "{:s}", 123.0f);
@@ -380,6 +644,89 @@ static void test_float()
 	test_eq(error_str, "{:B}", 123.0);
 }
 
+static void test_fixed()
+{
+	// Q16.16
+	test_eq("1.5", "{}", mf::fixed<16>(0x18000));
+	test_eq("-1.5", "{}", mf::fixed<16>(-0x18000));
+	test_eq("0.1", "{}", mf::fixed<16>(6554));
+	test_eq("0.00002", "{}", mf::fixed<16>(1));
+	test_eq("32767.99998", "{}", mf::fixed<16>(INT32_MAX));
+	test_eq("-32768", "{}", mf::fixed<16>(INT32_MIN));
+	test_eq("0.10001", "{:.5}", mf::fixed<16>(6554));
+	test_eq("0.100006103515625000", "{:.18}", mf::fixed<16>(6554));
+	test_eq("0.100006", "{:f}", mf::fixed<16>(6554));
+	test_eq("2", "{:.0}", mf::fixed<16>(0x18000));
+	test_eq("2.50|2.9", "{:.2}|{:.1}", mf::fixed<2>(10), mf::fixed<4>(47));
+
+	// rounding half to even with carry to integral part
+	test_eq("0.2", "{:.1}", mf::fixed<2>(1));
+	test_eq("0.8", "{:.1}", mf::fixed<2>(3));
+	test_eq("10.0", "{:.1}", mf::fixed<5>(319));
+	test_eq("-0.00", "{:.2}", mf::fixed<16>(-1));
+
+	// Q1.15 and integers
+	test_eq("-1", "{}", mf::fixed<15>(-32768));
+	test_eq("0.99997", "{}", mf::fixed<15>(32767));
+	test_eq("0.5", "{}", mf::fixed<31>(1 << 30));
+	test_eq("123", "{}", mf::fixed<0>(123));
+
+	// width, sign and alignment
+	test_eq("   1.50|", "{:7.2}|", mf::fixed<8>(384));
+	test_eq("+1.50  |", "{:<+7.2}|", mf::fixed<8>(384));
+	test_eq("-001.50", "{:07.2}", mf::fixed<8>(-384));
+	test_eq("__1.5__", "{:_^7}", mf::fixed<8>(384));
+	test_eq("U= 12.35V", MF_FMT("U={:6.2}V"), mf::fixed<16>(809370));
+
+	test_eq(error_str, "{:x}", mf::fixed<8>(384));
+	test_eq(error_str, "{:e}", mf::fixed<8>(384));
+}
+
+static void test_pointer()
+{
+	const void* ptr = (const void*)(uintptr_t)0x1234;
+	std::string zeros(2 * sizeof(void*) - 4, '0');
+
+	test_eq("0x" + zeros + "1234", "{}", ptr);
+	test_eq("0x" + zeros + "1234", "{:p}", ptr);
+	test_eq("1234", "{:x}", ptr);
+	test_eq("0X1234", "{:#X}", ptr);
+
+	test_eq(error_str, "{:p}", 1234);
+	test_eq(error_str, "{:p}", "str");
+}
+
+static void test_fill()
+{
+	test_eq("***str****", "{:*^10}", "str");
+	test_eq("str_________", "{:_<12}", "str");
+	test_eq("......-42|", "{:.>9}|", -42);
+	test_eq("+42======", "{:=<+9}", 42);
+	test_eq("--1.50--", "{:-^8.2}", 1.5);
+	test_eq("0x1f....", "{:.<#8x}", 0x1F);
+	test_eq("<<x", "{:<>3}", 'x');
+	test_eq("42000", "{:0<5}", 42);
+	test_eq("^^^^^^", "{:^^6}", "");
+	test_eq("ab-----c", "{1}{0:->6}", "c", "ab");
+	test_eq("[   str]", MF_FMT("[{: >6}]"), "str");
+	test_eq("#####true", MF_FMT("{:#>9}"), true);
+
+	// fill without alignment is wrong
+	test_eq(error_str + ":*10}", "{:*10}", 1);
+	test_eq(error_str + ":*<>10}", "{:*<>10}", 1);
+	test_eq(error_str + ":" + error_str, "{:{<10}", 1);
+
+	// wide padding is passed by blocks
+	std::string text;
+	auto append_text = [](void* data, const char* str, size_t len)
+	{
+		((std::string*)data)->append(str, len);
+		return len;
+	};
+	mf::format(append_text, &text, "|{:=^50}|", " title ");
+	assert(text == "|" + std::string(21, '=') + " title " + std::string(22, '=') + "|");
+}
+
 static void test_arg_pos()
 {
 	test_eq("1234", "{}{}{}{}", 1, 2, 3, 4);
@@ -389,8 +736,618 @@ static void test_arg_pos()
 	test_eq("4321", "{3}{2}{1}{0}", 1, 2, 3, 4);
 
 	test_eq("1"+error_str+"1", "{0}{1}{0}", 1);
+
+	// arguments with different types packed into descriptor
+	test_eq(
+		"1 2 c d true s 1.5 -8 9 x y z 13 1.25 false last",
+		"{} {} {} {} {} {} {:.1} {} {} {} {} {} {} {:.2} {} {}",
+		1, 2U, 'c', (unsigned char)'d', true, "s", 1.5, -8L, 9UL, 'x', "y", std::string("z"), 13, 1.25f, false, "last"
+	);
+	test_eq("last 1", MF_FMT("{15} {0}"), 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, "last");
+
+	// more than 16 arguments: types are passed as array
+	test_eq(
+		"1 2 c true s -8 x y z 13 false a 17 b 19 last",
+		"{} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}",
+		1, 2U, 'c', true, "s", -8L, 'x', "y", std::string("z"), 13, false, 'a', 17U, "b", 19, "last"
+	);
+	test_eq(
+		"1 2 c true s -8 x y z 13 false a 17 b 19 last",
+		"{} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {16}",
+		1, 2U, 'c', true, "s", -8L, 'x', "y", std::string("z"), 13, false, 'a', 17U, "b", 19, 0, "last"
+	);
+	test_eq("last|   1", MF_FMT("{17}|{0:{16}}"), 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 4, "last");
+	test_eq("last|   1", "{17}|{0:{16}}", 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 4, "last");
+	test_eq(error_str, "{0:{17}}", 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 4, "last");
+}
+
+static void test_dynamic_width()
+{
+	test_eq("   42|", "{:{}}|", 42, 5);
+	test_eq("42   |", "{:<{}}|", 42, 5U);
+	test_eq("3.142", "{:.{}}", 3.14159, 3);
+	test_eq("  3.14|", "{:{}.{}}|", 3.14159, 6, 2);
+	test_eq("**abc**", "{:*^{}}", "abc", 7);
+	test_eq("abcd  |", "{:{}.{}}|", "abcdef", 6, 4);
+	test_eq("00042", "{:0{}}", 42, 5);
+	test_eq("str", "{:{}}", "str", 0);
+
+	// positional
+	test_eq("  1.50|x", "{0:{1}.{2}}|{3}", 1.5, 6, 2, 'x');
+	test_eq("    7", "{1:{0}}", 5, 7);
+	test_eq("1.23|   1.23", "{2:.{0}}|{2:{1}.{0}}", 2, 7, 1.23);
+
+	// automatic index after nested fields
+	test_eq("a  |b", "{:{}}|{}", "a", 3, "b");
+	test_eq("  1.0|2", "{:{}.{}}|{}", 1.0, 5, 1, 2);
+
+	// compile-time format
+	test_eq("   42|2.50", MF_FMT("{:{}}|{:.{}f}"), 42, 5, 2.5, 2);
+
+	// width and precision must be non-negative integers
+	test_eq(error_str, "{:{}}", 42, -1);
+	test_eq(error_str, "{:.{}}", 1.5, -2);
+	test_eq(error_str, "{:{}}", 42, "5");
+	test_eq(error_str, "{:{}}", 42, 1.5);
+	test_eq(error_str, "{:{}}", 42);
+	test_eq(error_str, MF_FMT("{:{}}"), 42, -1);
+
+	// wrong nested fields
+	mf::impl::FormatSegment segments[4];
+	assert(mf::impl::parse_format_segments("{:{}}", segments, 4) == 2);
+	assert(mf::impl::parse_format_segments("{:{}5}", segments, 4) == 0);
+	assert(mf::impl::parse_format_segments("{:5{}}", segments, 4) == 0);
+	assert(mf::impl::parse_format_segments("{:{x}}", segments, 4) == 0);
+	assert(mf::impl::parse_format_segments("{:{}{}}", segments, 4) == 0);
+	assert(mf::impl::parse_format_segments("{:{128}}", segments, 4) == 0);
+	assert(mf::impl::parse_format_segments("{:5#0}", segments, 4) == 0);
 }
 
+static void test_custom_type()
+{
+	Ip4 ip{ 192, 168, 0, 1 };
+
+	test_eq("ip=192.168.0.1 state=running", "ip={} state={}", ip, State::Running);
+	test_eq("[idle    ] 0", "[{:8}] {:d}", State::Idle, State::Idle);
+	test_eq("    192.168.0.1|", "{:>15}|", ip);
+	test_eq("**10.0.0.1**", "{:*^12}", Ip4{ 10, 0, 0, 1 });
+	test_eq("192.168.0.1", "{:4}", ip);
+	test_eq("running 1", MF_FMT("{} {:d}"), State::Running, State::Running);
+	test_eq("1: 192.168.0.1", MF_FMT("{1}: {0:<4}"), ip, 1);
+
+	// block callback and early stop
+	char small[8];
+	assert(mf::format(small, "{}", ip) == 7);
+	assert(strcmp(small, "192.168") == 0);
+
+	std::string text;
+	auto append_char = [](void* data, char chr)
+	{
+		((std::string*)data)->push_back(chr);
+		return true;
+	};
+	assert(mf::format(append_char, &text, "{} {}", State::Idle, ip) == 16);
+	assert(text == "idle 192.168.0.1");
+
+	std::vector<std::tuple<Ip4, State>> records = { { ip, State::Idle }, { Ip4{ 1, 2, 3, 4 }, State::Running } };
+	text.clear();
+	mf::format_batch(text, "{} {};", records);
+	assert(text == "192.168.0.1 idle;1.2.3.4 running;");
+
+	// width of utf8 text is in code points
+	test_eq_unicode(u8"[    日本]", u8"[{:>6}]", Name{ u8"日本" });
+	test_eq_unicode(u8"[**Тест**]", u8"[{:*^8}]", Name{ u8"Тест" });
+	test_eq_unicode(u8"[日本 ]", MF_FMT(u8"[{:3}]"), Name{ u8"日本" });
+}
+
+static void test_compiled_format()
+{
+	test_eq("", MF_FMT(""));
+	test_eq("Simple text", MF_FMT("Simple text"));
+	test_eq("Simple text arg Another text", MF_FMT("Simple text {} Another text"), "arg");
+	test_eq("{42}", MF_FMT("{{{}}"), 42);
+	test_eq("{{", MF_FMT("{{{{"));
+	test_eq("U=    1.25v", MF_FMT("U={:8.2}v"), 1.25f);
+	test_eq("-0x0123", MF_FMT("{:#07x}"), -0x123);
+	test_eq("4321", MF_FMT("{3}{2}{1}{0}"), 1, 2, 3, 4);
+	test_eq("  str  |true|A", MF_FMT("{:^7}|{}|{:c}"), "str", true, 65);
+
+	char buffer[5] = {};
+	auto printed = mf::format(buffer, MF_FMT("{}{}"), 123, 456);
+	assert(printed == 4);
+	assert(strcmp(buffer, "1234") == 0);
+
+	test_eq_unicode(u8"Русский текст 日本語テキスト", MF_FMT(u8"Русский текст {}"), u8"日本語テキスト");
+}
+
+static void test_block_callback()
+{
+	struct Data
+	{
+		std::string text;
+		int calls_count = 0;
+	};
+
+	auto block_callback = [](void* data, const char* text, size_t len)
+	{
+		auto* d = (Data*)data;
+		d->text.append(text, len);
+		d->calls_count++;
+		return len;
+	};
+
+	Data data;
+	auto printed = mf::format(block_callback, &data, "Long literal text {:10} {:>6} {:08x}", "str", 12345, 0xABCD);
+	assert(data.text == "Long literal text str         12345 0000abcd");
+	assert(printed == data.text.size());
+	assert(data.calls_count < 10);
+
+	Data data2;
+	printed = mf::format(block_callback, &data2, MF_FMT("{{{}} text"), -42);
+	assert(data2.text == "{-42} text");
+	assert(printed == data2.text.size());
+}
+
+static void test_formatted_size()
+{
+	assert(mf::formatted_size("") == 0);
+	assert(mf::formatted_size("text {{}}") == 8);
+	assert(mf::formatted_size("{}", 1234567) == 7);
+	assert(mf::formatted_size("{:#x}", 0xABCDU) == 6);
+	assert(mf::formatted_size("{:10}|{:<3}", "str", "long text") == 20);
+	assert(mf::formatted_size("{:^9}", 'c') == 9);
+	assert(mf::formatted_size("{:+08.2}", 1.5) == 8);
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+	assert(mf::formatted_size("{}", 1e100) == 6);
+#endif
+	assert(mf::formatted_size("{:s}", 42) == error_str.size());
+	assert(mf::formatted_size(MF_FMT("U={:8.2}v"), 11.2f) == 11);
+
+	char buffer[4] = {};
+	auto printed = mf::format(buffer, "{}", 1234567);
+	assert(printed == 3);
+	assert(mf::formatted_size("{}", 1234567) == 7);
+}
+
+static void test_early_stop()
+{
+	struct Data
+	{
+		std::string text;
+		size_t limit = 0;
+		int calls_count = 0;
+	};
+
+	auto limited_callback = [](void* data, const char* text, size_t len)
+	{
+		auto* d = (Data*)data;
+		d->calls_count++;
+		size_t free_space = d->limit - d->text.size();
+		if (len > free_space) len = free_space;
+		d->text.append(text, len);
+		return len;
+	};
+
+	Data data;
+	data.limit = 10;
+	auto printed = mf::format(limited_callback, &data, "{} {} {} {:>20}", 11111, 22222, 33333, 44444);
+	assert(printed == 10);
+	assert(data.text == "11111 2222");
+	assert(data.calls_count == 3);
+
+	char buffer[8] = {};
+	auto result = mf::format_to_n(buffer, "{}-{}", 1234, 56789);
+	assert(result.printed == 7);
+	assert(result.size == 10);
+	assert(std::string(buffer) == "1234-56");
+
+	result = mf::format_to_n(buffer, "{}", 42);
+	assert(result.printed == 2);
+	assert(result.size == 2);
+
+	result = mf::format_to_n(buffer, 3, MF_FMT("{:>10}"), 1);
+	assert(result.printed == 2);
+	assert(result.size == 10);
+	assert(std::string(buffer) == "  ");
+}
+
+static void test_format_cache()
+{
+	mf::FormatCache<4, 4> cache;
+	char buffer[64] = {};
+
+	// format strings from run-time table
+	std::string formats[] = { "U={:6.2}v {}", "{:>5}|{:<5}|", "{{{}}", "{} {} {} {} {}" };
+
+	for (int i = 0; i < 3; i++)
+	{
+		assert(cache.format(buffer, formats[0].c_str(), 3.14159, "ok") == 12);
+		assert(std::string(buffer) == "U=  3.14v ok");
+		cache.format(buffer, formats[1].c_str(), 1, 2);
+		assert(std::string(buffer) == "    1|2    |");
+		cache.format(buffer, formats[2].c_str(), 'c');
+		assert(std::string(buffer) == "{c}");
+	}
+
+	// more segments than cache entry may have
+	cache.format(buffer, formats[3].c_str(), 1, 2, 3, 4, 5);
+	assert(std::string(buffer) == "1 2 3 4 5");
+
+	assert(cache.get_hits_count() + cache.get_misses_count() == 10);
+	assert(cache.get_misses_count() >= 4);
+
+	// long string doesn't replace cached string in the same entry
+	auto check_long_str = [&](auto& one_entry_cache)
+	{
+		one_entry_cache.format(buffer, formats[0].c_str(), 1.0, "a");
+		for (int i = 0; i < 2; i++)
+		{
+			one_entry_cache.format(buffer, formats[3].c_str(), 1, 2, 3, 4, 5);
+			assert(std::string(buffer) == "1 2 3 4 5");
+			uint32_t hits = one_entry_cache.get_hits_count();
+			one_entry_cache.format(buffer, formats[0].c_str(), 1.0, "a");
+			assert(one_entry_cache.get_hits_count() == hits + 1);
+			assert(std::string(buffer) == "U=  1.00v a");
+		}
+	};
+
+	mf::FormatCache<1, 4> one_entry_cache;
+	check_long_str(one_entry_cache);
+	mf::SyncFormatCache<1, 4> one_entry_sync_cache;
+	check_long_str(one_entry_sync_cache);
+
+	// same cached string with wrong argument types
+	cache.format(buffer, formats[1].c_str(), 1, 2);
+	cache.format(buffer, formats[1].c_str(), "text", 'c');
+	assert(std::string(buffer) == " text|c    |");
+	std::string hex_format = "{:x}|{}";
+	cache.format(buffer, hex_format.c_str(), 255, 1);
+	assert(std::string(buffer) == "ff|1");
+	cache.format(buffer, hex_format.c_str(), "ff", 1);
+	assert(std::string(buffer) == "{{error}}|ff");
+	cache.format(buffer, formats[0].c_str());
+	assert(std::string(buffer) == "U={{error}}v {{error}}");
+
+	cache.clear();
+	cache.format(buffer, "{:08x}", 0xABCDU);
+	assert(std::string(buffer) == "0000abcd");
+	assert(cache.get_hits_count() == 0);
+	assert(cache.get_misses_count() == 1);
+
+	// many threads
+
+	static mf::SyncFormatCache<2> sync_cache;
+	std::vector<std::thread> threads;
+	std::atomic<int> errors { 0 };
+
+	for (int t = 0; t < 4; t++)
+	{
+		threads.emplace_back([t, &formats, &errors] {
+			char result[64] = {};
+			char desired[64] = {};
+			for (int i = 0; i < 10000; i++)
+			{
+				const char* format_str = formats[(i + t) % 3 + 1].c_str();
+				sync_cache.format(result, format_str, t, i, t, i, t);
+				mf::format(desired, format_str, t, i, t, i, t);
+				if (strcmp(result, desired) != 0) errors++;
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	assert(errors == 0);
+	assert(sync_cache.get_hits_count() + sync_cache.get_misses_count() == 40000);
+}
+
+static void test_ring_buffer()
+{
+	auto append_record = [](void* data, const char* text, size_t len)
+	{
+		((std::vector<std::string>*)data)->emplace_back(text, len);
+		return len;
+	};
+
+	// one producer
+
+	mf::RingBuffer<8, 8> ring;
+	std::vector<std::string> records;
+
+	assert(ring.format("{} {}", "first", 1));
+	assert(ring.format(MF_FMT("second record {:04}"), 2));
+	assert(ring.format(""));
+	assert(ring.drain(append_record, &records) == 3);
+	assert((records == std::vector<std::string>{ "first 1", "second record 0002", "" }));
+	assert(ring.drain(append_record, &records) == 0);
+
+	// record doesn't fit at the end of buffer and is placed to beginning
+
+	records.clear();
+	assert(ring.format("{:30}", "wrapped record"));
+	assert(ring.drain(append_record, &records) == 1);
+	assert(records[0] == "wrapped record                ");
+
+	// no free space
+
+	assert(ring.format("{:32}", 1));
+	assert(!ring.format("{:40}", 2));
+	assert(!ring.format("{:100}", 3));
+	assert(ring.get_dropped_count() == 2);
+
+	std::string chars;
+	auto append_char = [](void* data, char chr)
+	{
+		((std::string*)data)->push_back(chr);
+		return true;
+	};
+	assert(ring.drain(append_char, &chars) == 1);
+	assert(chars.size() == 32);
+
+	// callback accepts part of record: rest of record is passed by next drain
+
+	struct LimitedSink
+	{
+		std::string text;
+		size_t free;
+	};
+
+	auto append_limited = [](void* data, const char* text, size_t len)
+	{
+		auto* sink = (LimitedSink*)data;
+		size_t accepted = (len < sink->free) ? len : sink->free;
+		sink->text.append(text, accepted);
+		sink->free -= accepted;
+		return accepted;
+	};
+
+	LimitedSink sink = { "", 4 };
+	assert(ring.format("partial {}", 1));
+	assert(ring.format("next"));
+	assert(ring.drain(append_limited, &sink) == 0);
+	assert(sink.text == "part");
+	sink.free = 3;
+	assert(ring.drain(append_limited, &sink) == 0);
+	assert(sink.text == "partial");
+	sink.free = 100;
+	assert(ring.drain(append_limited, &sink) == 2);
+	assert(sink.text == "partial 1next");
+
+	auto append_char_limited = [](void* data, char chr)
+	{
+		auto* sink = (LimitedSink*)data;
+		if (sink->free == 0) return false;
+		sink->text.push_back(chr);
+		sink->free--;
+		return true;
+	};
+
+	sink = { "", 2 };
+	assert(ring.format("abc"));
+	assert(ring.drain(append_char_limited, &sink) == 0);
+	sink.free = 1;
+	assert(ring.drain(append_char_limited, &sink) == 1);
+	assert(sink.text == "abc");
+
+	// many producers and one consumer
+
+	const int threads_count = 8;
+	const int records_per_thread = 20000;
+
+	static mf::RingBuffer<256> mt_ring;
+	std::atomic<int> working_threads { threads_count };
+	std::vector<std::thread> threads;
+
+	for (int t = 0; t < threads_count; t++)
+	{
+		threads.emplace_back([&, t] {
+			for (int i = 0; i < records_per_thread; i++)
+			{
+				std::string tail(i % 40, '.');
+				while (!mt_ring.format("{} {} {}", t, i, tail.c_str()))
+					std::this_thread::yield();
+			}
+			working_threads--;
+		});
+	}
+
+	std::vector<int> next_index(threads_count, 0);
+	auto check_record = [](void* data, const char* text, size_t len)
+	{
+		auto& next = *(std::vector<int>*)data;
+		int t = 0, i = 0;
+		sscanf(std::string(text, len).c_str(), "%d %d", &t, &i);
+		assert(i == next[t]);
+		char desired[64] = {};
+		mf::format(desired, "{} {} {}", t, i, std::string(i % 40, '.').c_str());
+		assert(std::string(text, len) == desired);
+		next[t]++;
+		return len;
+	};
+
+	while (working_threads != 0)
+		mt_ring.drain(check_record, &next_index);
+	mt_ring.drain(check_record, &next_index);
+
+	for (auto& thread : threads)
+		thread.join();
+
+	for (int index : next_index)
+		assert(index == records_per_thread);
+}
+
+static void test_log_deferred()
+{
+	auto append_text = [](void* data, const char* text, size_t len)
+	{
+		((std::string*)data)->append(text, len);
+		return len;
+	};
+
+	mf::RingBuffer<16, 32> ring;
+
+	char changing_str[16] = "before";
+	assert(mf::log_deferred(ring, "{} {:04x} {:.2} {}\n", -42, 0xABCU, 1.5, "literal"));
+	assert(mf::log_deferred(ring, "str={} copy={}\n", changing_str, mf::copy_str(changing_str)));
+	assert(mf::log_deferred(ring, "no args\n"));
+	assert(mf::log_deferred(ring, "{:s}\n", 42));
+	strcpy(changing_str, "after");
+
+	std::string text;
+	assert(mf::drain_deferred(ring, append_text, &text) == 4);
+	assert(text == "-42 0abc 1.50 literal\nstr=after copy=before\nno args\n" + error_str + "\n");
+
+	std::string chars;
+	auto append_char = [](void* data, char chr)
+	{
+		((std::string*)data)->push_back(chr);
+		return true;
+	};
+	assert(mf::log_deferred(ring, "{}{}", 'a', true));
+	assert(mf::drain_deferred(ring, append_char, &chars) == 1);
+	assert(chars == "atrue");
+
+	// std::string and string views are copied into record
+	{
+		std::string long_str(20, 'x');
+		const char chars_arr[] = { 'a', 'b', 'c' };
+		assert(mf::log_deferred(ring, "[{}] [{}] [{}] [{}]", std::string("temporary"), long_str, mf::str_view(chars_arr, 3), std::string()));
+		long_str.assign(20, 'y');
+	}
+	text.clear();
+	assert(mf::drain_deferred(ring, append_text, &text) == 1);
+	assert(text == "[temporary] [" + std::string(20, 'x') + "] [abc] []");
+}
+
+static void test_format_range()
+{
+	char buffer[256];
+
+	const int ints[] = { -1, 20, 300 };
+	mf::format_range(buffer, "{:4}", ints, 3);
+	assert(strcmp(buffer, "  -1,   20,  300") == 0);
+	mf::format_range(buffer, "[{:x}]", ints + 1, 2, "");
+	assert(strcmp(buffer, "[14][12c]") == 0);
+
+	// uint8_t and int16_t are numbers, not characters
+	const uint8_t bytes[] = { 0, 127, 255 };
+	mf::format_range(buffer, "{:02X}", bytes, 3, " ");
+	assert(strcmp(buffer, "00 7F FF") == 0);
+	const int16_t shorts[] = { -32768, 32767 };
+	mf::format_range(buffer, "{:+}", shorts, 2, ";");
+	assert(strcmp(buffer, "-32768;+32767") == 0);
+
+	std::vector<double> doubles = { 1.5, -0.25, 100 };
+	assert(mf::format_range(buffer, "{:6.2}", doubles, "|") == 20);
+	assert(strcmp(buffer, "  1.50| -0.25|100.00") == 0);
+	const float floats[] = { 0.1f, 1e10f };
+#if defined (MICRO_FORMAT_SHORTEST_FLOAT)
+	mf::format_range(buffer, "{}", floats, 2);
+	assert(strcmp(buffer, "0.1, 1e+10") == 0);
+#else
+	mf::format_range(buffer, "{:.1}", floats, 2);
+	assert(strcmp(buffer, "0.1, 10000000000.0") == 0);
+#endif
+
+	// callbacks and early stop
+	std::string text;
+	auto append_char = [](void* data, char chr)
+	{
+		((std::string*)data)->push_back(chr);
+		return true;
+	};
+	assert(mf::format_range(append_char, &text, "<{}>", ints, 3) == 17);
+	assert(text == "<-1>, <20>, <300>");
+	char small[8];
+	assert(mf::format_range(small, "{}", ints, 3) == 7);
+	assert(strcmp(small, "-1, 20,") == 0);
+
+	// empty range and wrong format strings
+	assert(mf::format_range(buffer, "{}", ints, 0) == 0);
+	mf::format_range(buffer, "{} {}", ints, 3);
+	assert(buffer == error_str);
+	mf::format_range(buffer, "no field", ints, 3);
+	assert(buffer == error_str);
+	mf::format_range(buffer, "{:s}", ints, 3);
+	assert(buffer == error_str);
+}
+
+static void test_format_batch()
+{
+	static const char* names[] = { "", "a", "text", "longer text" };
+
+	std::vector<std::tuple<int, double, const char*>> records;
+	std::string desired = "header\n";
+	for (int i = 0; i < 20000; i++)
+	{
+		records.emplace_back(i - 10000, i / 7.0, names[i % 4]);
+		char buffer[64];
+		mf::format(buffer, "{},{:.3},{}\n", i - 10000, i / 7.0, names[i % 4]);
+		desired += buffer;
+	}
+
+	// records are appended to text
+	for (unsigned threads_count : { 1, 3, 8, 0 })
+	{
+		std::string text = "header\n";
+		size_t len = mf::format_batch(text, "{},{:.3},{}\n", records, threads_count);
+		assert(text == desired);
+		assert(len == desired.size() - 7);
+	}
+
+	std::string text;
+	assert(mf::format_batch(text, MF_FMT("{}:{:.1}|"), records.data(), 3, 4) == 31);
+	assert(text == "-10000:0.0|-9999:0.1|-9998:0.3|");
+
+	assert(mf::format_batch(text, "{}", records.data(), 0) == 0);
+}
+
+#if defined (__GNUC__) && defined (__ELF__)
+
+extern "C" const char __start_mf_fmt[];
+extern "C" const char __stop_mf_fmt[];
+
+static void test_format_id()
+{
+	auto append_text = [](void* data, const char* text, size_t len)
+	{
+		((std::string*)data)->append(text, len);
+		return len;
+	};
+
+	std::string log;
+	auto id = MF_FMT_ID("temp={:.1} state={} id={:#x}\n");
+	mf::format_id(append_text, &log, id, 23.5, "running", 0xBEEFU);
+	mf::format_id(append_text, &log, MF_FMT_ID("{} {} {} {:.1} {}\n"), -1234567, 'x', true, 1.5f, (const void*)0x1234);
+	const char chars[] = { 'a', 'b', 'c' };
+	mf::format_id(append_text, &log, MF_FMT_ID("[{}] [{}]\n"), mf::str_view(chars, 3), std::string("d\0e", 3));
+	size_t log_size = log.size();
+	auto size = mf::format_id(append_text, &log, MF_FMT_ID("no args"));
+	assert(size == log.size() - log_size);
+	assert(mf::impl::get_format_id(__start_mf_fmt) == 0);
+
+	std::string text;
+	auto* ptr = (const uint8_t*)log.data();
+	auto* end = ptr + log.size();
+	size_t strings_size = __stop_mf_fmt - __start_mf_fmt;
+	while (ptr != end)
+	{
+		size_t len = mf::decode_id_record(__start_mf_fmt, strings_size, ptr, end - ptr, append_text, &text);
+		assert(len != 0);
+		ptr += len;
+	}
+
+	std::string pointer_text;
+	mf::format(append_text, &pointer_text, "{}", (const void*)0x1234);
+	assert(text == "temp=23.5 state=running id=0xbeef\n-1234567 x true 1.5 " + pointer_text + "\n[abc] [" + std::string("d\0e", 3) + "]\nno args");
+
+	// incomplete record
+	assert(mf::decode_id_record(__start_mf_fmt, strings_size, (const uint8_t*)log.data(), 5, append_text, &text) == 0);
+}
+
+#endif
+
 static void test_individual_functions()
 {
 	char buffer[256] = {};
@@ -470,8 +1427,46 @@ static void test_utf8()
 	test_eq_unicode(u8"Русский текст 日本語テキスト",   u8"Русский текст {}", u8"日本語テキスト");
 	test_eq_unicode(u8"-Русский текст-日本語テキスト-", "-{}-{}-", u8"Русский текст", u8"日本語テキスト");
 
+	// long text is passed by several blocks
+	test_eq_unicode(
+		u8"Long mostly ASCII text with some Кириллица, then more ASCII text and 日本語 at the end",
+		u8"Long mostly ASCII text with some {}, then more ASCII text and {} at the end", u8"Кириллица", u8"日本語"
+	);
+
+	// sequence is split between literal text and argument
+	test_eq_unicode(u8"Ж", MF_FMT("\xD0{}"), "\x96");
+
+	// width and precision are in code points
+	test_eq_unicode(u8"|    Текст|",  u8"|{:>9}|", u8"Текст");
+	test_eq_unicode(u8"|Текст    |",  u8"|{:<9}|", u8"Текст");
+	test_eq_unicode(u8"| 日本語 |",    u8"|{:^5}|", u8"日本語");
+	test_eq_unicode(u8"|Тек  |",      u8"|{:5.3}|", u8"Текст");
+	test_eq_unicode(u8"|日本|",        MF_FMT(u8"|{:.2}|"), std::string(u8"日本語"));
+	test_eq_unicode(u8"|Long text with Кириллица   |", u8"|{:27}|", u8"Long text with Кириллица");
+	test_eq_unicode(u8"|Текст|",      u8"|{:3}|", u8"Текст");
+
 	// wrong sequenses
 	test_eq_unicode("before ? after", "before \xC0\xC1 after");
+	// byte which breaks sequence is skipped
+	test_eq_unicode("? ??", "\x80 \xE6\x97" "A\xFF");
+
+	// callback stops formatting
+	struct LimitedText
+	{
+		std::wstring text;
+		size_t limit;
+	} limited { L"", 3 };
+
+	auto limited_cb = [](void* data, const mf::WideChar* text, size_t len)
+	{
+		auto* d = (LimitedText*)data;
+		size_t accepted = (len < d->limit - d->text.size()) ? len : (d->limit - d->text.size());
+		d->text.append(text, text + accepted);
+		return accepted;
+	};
+
+	assert(mf::format_u8(limited_cb, &limited, u8"Тест {}", 12345) == 3);
+	assert(limited.text == L"Тес");
 }
 
 int main()
@@ -481,9 +1476,27 @@ int main()
 	test_integer();
 	test_bool();
 	test_str();
+	test_str_view();
 	test_char();
 	test_float();
+	test_fixed();
+	test_pointer();
+	test_fill();
 	test_arg_pos();
+	test_dynamic_width();
+	test_custom_type();
+	test_compiled_format();
+	test_block_callback();
+	test_formatted_size();
+	test_early_stop();
+	test_format_cache();
+	test_format_range();
+	test_format_batch();
+	test_ring_buffer();
+	test_log_deferred();
+#if defined (__GNUC__) && defined (__ELF__)
+	test_format_id();
+#endif
 	test_individual_functions();
 	test_print_to_buffer();
 	test_utf8();
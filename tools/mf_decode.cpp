@@ -0,0 +1,181 @@
+// Host-side decoder of records sent by mf::format_id
+//
+// Reads "mf_fmt" section with format strings from ELF file of firmware and
+// prints text of records from binary log (file or stdin). Records are printed
+// as soon as they are received, so stdin may be live stream from UART.
+//
+// Build:
+//   g++ -std=c++14 -O2 -DMICRO_FORMAT_DOUBLE -DMICRO_FORMAT_INT64 mf_decode.cpp ../micro_format.cpp ../micro_format_id.cpp -o mf_decode
+// Usage:
+//   mf_decode firmware.elf [log.bin]
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include "../micro_format_id.hpp"
+
+static uint64_t read_uint(const std::vector<uint8_t>& file, size_t offset, int size)
+{
+	uint64_t result = 0;
+	for (int i = 0; i < size; i++)
+		result |= (uint64_t)file.at(offset + i) << (8 * i);
+	return result;
+}
+
+// Finds section by name in little endian ELF32 or ELF64 file
+static bool read_elf_section(const std::vector<uint8_t>& file, const char* name, std::vector<char>& section)
+{
+	if ((file.size() < 64) || (memcmp(file.data(), "\x7F" "ELF", 4) != 0) || (file[5] != 1))
+		return false;
+
+	bool is_64 = (file[4] == 2);
+	int addr_size = is_64 ? 8 : 4;
+
+	uint64_t sh_offset = read_uint(file, is_64 ? 0x28 : 0x20, addr_size);
+	uint64_t sh_entsize = read_uint(file, is_64 ? 0x3A : 0x2E, 2);
+	uint64_t sh_count = read_uint(file, is_64 ? 0x3C : 0x30, 2);
+	uint64_t sh_strndx = read_uint(file, is_64 ? 0x3E : 0x32, 2);
+
+	auto get_section_offset = [&](uint64_t index) { return sh_offset + index * sh_entsize; };
+	auto get_field = [&](uint64_t index, int offset32, int offset64, int size32, int size64) {
+		return read_uint(file, get_section_offset(index) + (is_64 ? offset64 : offset32), is_64 ? size64 : size32);
+	};
+
+	uint64_t names_offset = get_field(sh_strndx, 0x10, 0x18, 4, 8);
+	uint64_t names_size = get_field(sh_strndx, 0x14, 0x20, 4, 8);
+	if ((names_offset > file.size()) || (names_size > file.size() - names_offset))
+		return false;
+
+	const char* names = (const char*)file.data() + names_offset;
+	size_t name_len = strlen(name);
+
+	for (uint64_t i = 0; i < sh_count; i++)
+	{
+		// name must be terminated by zero inside section of names
+		uint64_t name_offset = get_field(i, 0x00, 0x00, 4, 4);
+		if (name_offset >= names_size) continue;
+		const char* section_name = names + name_offset;
+		if (!memchr(section_name, 0, (size_t)(names_size - name_offset))) continue;
+		if (memcmp(section_name, name, name_len + 1) != 0) continue;
+
+		uint64_t offset = get_field(i, 0x10, 0x18, 4, 8);
+		uint64_t size = get_field(i, 0x14, 0x20, 4, 8);
+		if (offset + size > file.size()) return false;
+
+		section.assign(file.begin() + offset, file.begin() + offset + size);
+		return true;
+	}
+
+	return false;
+}
+
+static bool read_file(FILE* file, std::vector<uint8_t>& data)
+{
+	uint8_t buffer[4096];
+	size_t len = 0;
+	while ((len = fread(buffer, 1, sizeof(buffer), file)) != 0)
+		data.insert(data.end(), buffer, buffer + len);
+	return !ferror(file);
+}
+
+// Longer records are treated as wrong
+static const size_t max_record_size = 65536;
+
+// Size of record by its varint(payload len) header. Returns 0 if header is not
+// complete and value greater than max_record_size if header is wrong
+static size_t get_record_size(const uint8_t* data, size_t size)
+{
+	uint64_t len = 0;
+	for (size_t i = 0; (i < size) && (i < 10); i++)
+	{
+		len |= (uint64_t)(data[i] & 0x7F) << (7 * i);
+		if ((data[i] & 0x80) == 0)
+			return (len < max_record_size) ? (size_t)len + i + 1 : max_record_size + 1;
+	}
+	return (size < 10) ? 0 : max_record_size + 1;
+}
+
+static size_t print_text(void*, const char* text, size_t len)
+{
+	return fwrite(text, 1, len, stdout);
+}
+
+// Prints complete records from beginning of pending data. Incomplete record
+// is kept until next data is received or is skipped at end of log. Garbage
+// with wrong length delays output until that number of bytes is received
+static void decode_pending(const std::vector<char>& strings, std::vector<uint8_t>& pending, bool is_end)
+{
+	size_t pos = 0;
+	while (pos < pending.size())
+	{
+		const uint8_t* record = pending.data() + pos;
+		size_t size = pending.size() - pos;
+		size_t len = mf::decode_id_record(strings.data(), strings.size(), record, size, print_text, nullptr);
+
+		if (len == 0)
+		{
+			size_t record_size = get_record_size(record, size);
+			bool is_incomplete = (record_size == 0) || ((record_size > size) && (record_size <= max_record_size));
+			if (is_incomplete && !is_end) break;
+
+			// skip one byte to resynchronize after wrong record
+			len = 1;
+		}
+
+		pos += len;
+	}
+
+	pending.erase(pending.begin(), pending.begin() + pos);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	if ((argc < 2) || (argc > 3))
+	{
+		fprintf(stderr, "Usage: %s firmware.elf [log.bin]\n", argv[0]);
+		return 1;
+	}
+
+	FILE* elf_file = fopen(argv[1], "rb");
+	std::vector<uint8_t> elf;
+	if (!elf_file || !read_file(elf_file, elf))
+	{
+		fprintf(stderr, "Can't read %s\n", argv[1]);
+		return 1;
+	}
+	fclose(elf_file);
+
+	std::vector<char> strings;
+	if (!read_elf_section(elf, "mf_fmt", strings))
+	{
+		fprintf(stderr, "Section mf_fmt is not found in %s\n", argv[1]);
+		return 1;
+	}
+
+	FILE* log_file = (argc == 3) ? fopen(argv[2], "rb") : stdin;
+	if (!log_file)
+	{
+		fprintf(stderr, "Can't read log\n");
+		return 1;
+	}
+
+	// getc returns as soon as any data is received from stream
+	std::vector<uint8_t> pending;
+	int chr = 0;
+	while ((chr = getc(log_file)) != EOF)
+	{
+		pending.push_back((uint8_t)chr);
+		decode_pending(strings, pending, false);
+	}
+	decode_pending(strings, pending, true);
+
+	if (ferror(log_file))
+	{
+		fprintf(stderr, "Can't read log\n");
+		return 1;
+	}
+
+	return 0;
+}